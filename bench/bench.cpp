@@ -0,0 +1,502 @@
+// Reproducible rendering benchmark. Renders a fixed set of scenes offscreen
+// and reports per-stage frame time percentiles, optionally as JSON so that
+// results can be diffed across commits.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <numbers>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "camera.hpp"
+#include "mesh_optimizer.hpp"
+#include "model.hpp"
+#include "rasterizer.hpp"
+#include "thread_pool.hpp"
+
+using namespace rasterizer;
+
+using std::string;
+using std::vector;
+using std::filesystem::path;
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+// Heap allocations of the whole program, counted by the replaced global
+// operator new, so that frames can be checked to make none once warmed up.
+static std::atomic<size_t> heap_allocations{0};
+
+// None of the replacements are inlined. GCC would otherwise see malloc and
+// free at the call sites and mistake the pairs of new and delete for
+// mismatched ones.
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+struct Workload
+{
+    string name;
+    std::function<Model()> load;
+    // Instances per side of a grid of instances of the model, see
+    // make_instances, or 0 to draw the model once.
+    int grid = 0;
+};
+
+struct Resolution
+{
+    int width;
+    int height;
+};
+
+struct Summary
+{
+    double mean, min, p50, p90, p99, max;
+};
+
+struct Result
+{
+    string scene;
+    Resolution resolution;
+    size_t triangles;
+    // Heap allocations made while drawing the frames after warm-up.
+    size_t allocations;
+
+    // Samples per stage in milliseconds, in the order of stage_names.
+    vector<vector<double>> samples;
+};
+
+constexpr std::array stage_names{"vertex", "setup", "raster", "fragment",
+                                 "total"};
+
+// Appends the two triangles of the quad spanned by the given vertex indices
+// of a row-major grid with the given width.
+static void add_quad(vector<uint32_t> &indices, uint32_t row_width, uint32_t i,
+                     uint32_t j)
+{
+    uint32_t v = i + j * row_width;
+
+    indices.insert(indices.end(), {v, v + 1, v + row_width});
+    indices.insert(indices.end(), {v + 1, v + row_width + 1, v + row_width});
+}
+
+// UV sphere with the given number of rings and segments.
+static Model make_sphere(int rings, int segments)
+{
+    const float pi = std::numbers::pi_v<float>;
+
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+
+    for (int i = 0; i <= rings; i++)
+    {
+        for (int j = 0; j <= segments; j++)
+        {
+            float theta = pi * i / rings;
+            float phi = 2.f * pi * j / segments;
+
+            Vec3 n{std::sin(theta) * std::cos(phi), std::cos(theta),
+                   std::sin(theta) * std::sin(phi)};
+
+            vertices.push_back(
+                Vertex{n, n,
+                       Vec2{static_cast<float>(j) / segments,
+                            1.f - static_cast<float>(i) / rings}});
+        }
+    }
+
+    for (int i = 0; i < rings; i++)
+        for (int j = 0; j < segments; j++)
+            add_quad(indices, segments + 1, j, i);
+
+    Model model{};
+    model.mesh =
+        std::make_unique<Mesh>(std::move(vertices), std::move(indices));
+    return model;
+}
+
+// Stack of camera-facing planes split into cells x cells quads each. Layers
+// are submitted back to front, so every layer overdraws the previous one.
+static Model make_grid(int cells, int layers)
+{
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+
+    for (int l = 0; l < layers; l++)
+    {
+        float z = -0.5f + 0.5f * (l + 1) / layers;
+        auto first = static_cast<uint32_t>(vertices.size());
+
+        for (int j = 0; j <= cells; j++)
+        {
+            for (int i = 0; i <= cells; i++)
+            {
+                float u = static_cast<float>(i) / cells;
+                float v = static_cast<float>(j) / cells;
+
+                vertices.push_back(
+                    Vertex{Vec3{3.f * u - 1.5f, 3.f * v - 1.5f, z},
+                           Vec3{0.f, 0.f, 1.f}, Vec2{u, v}});
+            }
+        }
+
+        for (int j = 0; j < cells; j++)
+            for (int i = 0; i < cells; i++)
+                add_quad(indices, cells + 1, first + i, j);
+    }
+
+    Model model{};
+    model.mesh =
+        std::make_unique<Mesh>(std::move(vertices), std::move(indices));
+    return model;
+}
+
+// Grid of count x count instances of the model around the camera target,
+// spaced such that most of them lie outside of the view frustum.
+static Scene make_instances(Model &&model, int count)
+{
+    Scene scene;
+    auto index = scene.add_model(std::move(model));
+
+    for (int j = 0; j < count; j++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Vec3 offset{1.5f * (i - count / 2), 1.5f * (j - count / 2), -2.f};
+            scene.add_instance(index, translate(Mat4{1.f}, offset));
+        }
+    }
+
+    return scene;
+}
+
+static Summary summarize(vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    // Nearest-rank percentile.
+    auto percentile = [&](double p)
+    {
+        auto rank = static_cast<size_t>(std::ceil(p * samples.size()));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    };
+
+    double sum = 0.;
+    for (auto s : samples)
+        sum += s;
+
+    return Summary{sum / samples.size(), samples.front(), percentile(0.5),
+                   percentile(0.9),      percentile(0.99), samples.back()};
+}
+
+static Result run(const Workload &workload, Resolution resolution,
+                  ShadingMode mode, bool optimized, FrameLayout layout,
+                  DepthFormat depth_format, int warmup_count, int frame_count)
+{
+    auto model = workload.load();
+    if (optimized)
+        optimize(*model.mesh);
+
+    Rasterizer rasterizer{resolution.width, resolution.height,
+                          workload.grid > 0
+                              ? make_instances(std::move(model), workload.grid)
+                              : Scene{std::move(model)},
+                          layout};
+    rasterizer.set_shading_mode(mode);
+    rasterizer.set_depth_format(depth_format);
+
+    Camera camera{Vec3{0.f, 0.f, 2.f}, Vec3{0.f}};
+
+    Result result{workload.name, resolution, 0, 0,
+                  vector<vector<double>>(stage_names.size())};
+
+    for (int frame = 0; frame < warmup_count + frame_count; frame++)
+    {
+        // Fragment shading runs inside the raster stage. Its cost is
+        // isolated by rendering every frame once more without shading.
+        size_t allocations = heap_allocations;
+
+        rasterizer.set_shading(false);
+        rasterizer.clear();
+        rasterizer.draw(camera);
+        auto depth_only = rasterizer.get_stats();
+
+        rasterizer.set_shading(true);
+        rasterizer.clear();
+        rasterizer.draw(camera);
+        const auto &stats = rasterizer.get_stats();
+
+        allocations = heap_allocations - allocations;
+
+        if (frame < warmup_count)
+            continue;
+
+        // Scratch storage is reused once the first frames have sized it,
+        // which main() checks.
+        result.allocations += allocations;
+
+        double vertex = Milliseconds{stats.vertex}.count();
+        double setup = Milliseconds{stats.setup}.count();
+        double raster = Milliseconds{depth_only.raster}.count();
+        double fragment = std::max(
+            0., Milliseconds{stats.raster - depth_only.raster}.count());
+
+        result.triangles = stats.triangles;
+        result.samples[0].push_back(vertex);
+        result.samples[1].push_back(setup);
+        result.samples[2].push_back(raster);
+        result.samples[3].push_back(fragment);
+        result.samples[4].push_back(
+            Milliseconds{stats.vertex + stats.setup + stats.raster}.count());
+    }
+
+    return result;
+}
+
+static string escape(std::string_view s)
+{
+    string escaped;
+
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+static const char *depth_format_name(DepthFormat format)
+{
+    switch (format)
+    {
+    case DepthFormat::unorm24:
+        return "unorm24";
+    case DepthFormat::unorm16:
+        return "unorm16";
+    default:
+        return "float32";
+    }
+}
+
+static void write_json(std::ostream &out, const vector<Result> &results,
+                       ShadingMode mode, bool optimized, FrameLayout layout,
+                       DepthFormat depth_format, int frame_count,
+                       size_t thread_count)
+{
+    out << "{\n  \"shading\": \""
+        << (mode == ShadingMode::deferred ? "deferred" : "forward")
+        << "\",\n  \"optimized\": " << (optimized ? "true" : "false")
+        << ",\n  \"layout\": \""
+        << (layout == FrameLayout::tiled ? "tiled" : "linear") << "\""
+        << ",\n  \"depth\": \"" << depth_format_name(depth_format) << "\""
+        << ",\n  \"frames\": " << frame_count
+        << ",\n  \"threads\": " << thread_count << ",\n  \"results\": [";
+
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        const auto &result = results[r];
+
+        out << (r ? "," : "") << "\n    {\n      \"scene\": \""
+            << escape(result.scene) << "\",\n      \"width\": "
+            << result.resolution.width
+            << ",\n      \"height\": " << result.resolution.height
+            << ",\n      \"triangles\": " << result.triangles
+            << ",\n      \"allocations\": " << result.allocations
+            << ",\n      \"stages_ms\": {";
+
+        for (size_t i = 0; i < stage_names.size(); i++)
+        {
+            auto s = summarize(result.samples[i]);
+
+            out << (i ? "," : "") << "\n        \"" << stage_names[i]
+                << "\": {\"mean\": " << s.mean << ", \"min\": " << s.min
+                << ", \"p50\": " << s.p50 << ", \"p90\": " << s.p90
+                << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << "}";
+        }
+
+        out << "\n      }\n    }";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+static void print_result(const Result &result)
+{
+    char line[128];
+
+    std::snprintf(line, sizeof(line),
+                  "%-16s %4dx%-4d %8zu tris %4zu allocs\n",
+                  result.scene.c_str(), result.resolution.width,
+                  result.resolution.height, result.triangles,
+                  result.allocations);
+    std::cout << line;
+
+    for (size_t i = 0; i < stage_names.size(); i++)
+    {
+        auto s = summarize(result.samples[i]);
+
+        std::snprintf(line, sizeof(line),
+                      "    %-8s p50 %8.3f  p90 %8.3f  p99 %8.3f ms\n",
+                      stage_names[i], s.p50, s.p90, s.p99);
+        std::cout << line;
+    }
+}
+
+int help(const std::string_view msg)
+{
+    std::cout << msg
+              << "\nUsage: rasterizer_bench [--frames N] [--json output.json]"
+                 "\n    [--deferred] [--optimize] [--tiled]"
+                 "\n    [--depth-format float32|unorm24|unorm16]"
+                 "\n    [--obj model.obj]..."
+              << std::endl;
+    return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    int frame_count = 50;
+    int warmup_count = 5;
+    ShadingMode mode = ShadingMode::forward;
+    bool optimized = false;
+    FrameLayout layout = FrameLayout::linear;
+    DepthFormat depth_format = DepthFormat::float32;
+    path json_path;
+
+    // Parses the OBJ files of every run.
+    ThreadPool pool;
+
+    vector<Workload> workloads{
+        {"sphere_2k", [] { return make_sphere(32, 32); }},
+        {"sphere_130k", [] { return make_sphere(256, 256); }},
+        {"grid_large_tris", [] { return make_grid(2, 1); }},
+        {"grid_small_tris", [] { return make_grid(256, 1); }},
+        {"overdraw_8", [] { return make_grid(16, 8); }},
+        {"instances_1k", [] { return make_sphere(32, 32); }, 32},
+    };
+
+    const vector<Resolution> resolutions{{640, 480}, {1920, 1080}};
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg{argv[i]};
+
+        if (arg == "--deferred")
+        {
+            mode = ShadingMode::deferred;
+            continue;
+        }
+
+        if (arg == "--optimize")
+        {
+            optimized = true;
+            continue;
+        }
+
+        if (arg == "--tiled")
+        {
+            layout = FrameLayout::tiled;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            return help("Missing value for option " + string{arg} + ".");
+
+        const char *value = argv[++i];
+
+        if (arg == "--frames")
+        {
+            if (std::sscanf(value, "%d", &frame_count) != 1 ||
+                frame_count <= 0)
+                return help("Invalid frame count provided.");
+        }
+        else if (arg == "--json")
+            json_path = value;
+        else if (arg == "--depth-format")
+        {
+            std::string_view name{value};
+
+            if (name == "float32")
+                depth_format = DepthFormat::float32;
+            else if (name == "unorm24")
+                depth_format = DepthFormat::unorm24;
+            else if (name == "unorm16")
+                depth_format = DepthFormat::unorm16;
+            else
+                return help("Invalid depth format provided.");
+        }
+        else if (arg == "--obj")
+        {
+            path obj_path{value};
+            workloads.push_back({obj_path.stem().string(), [obj_path, &pool]
+                                 { return Model::from_obj(obj_path, pool); }});
+        }
+        else
+            return help("Unknown option " + string{arg} + ".");
+    }
+
+    vector<Result> results;
+
+    for (const auto &workload : workloads)
+    {
+        for (auto resolution : resolutions)
+        {
+            results.push_back(
+                run(workload, resolution, mode, optimized, layout,
+                    depth_format, warmup_count, frame_count));
+            print_result(results.back());
+        }
+    }
+
+    if (!json_path.empty())
+    {
+        std::ofstream fs(json_path);
+        if (!fs.is_open())
+            return help("Could not open " + json_path.string() + ".");
+
+        write_json(fs, results, mode, optimized, layout, depth_format,
+                   frame_count, pool.size());
+    }
+
+    // Frames after warm-up must not allocate, in release builds too.
+    int status = 0;
+
+    for (const auto &result : results)
+    {
+        if (result.allocations == 0)
+            continue;
+
+        std::cerr << result.scene << " at " << result.resolution.width << "x"
+                  << result.resolution.height << " made "
+                  << result.allocations
+                  << " heap allocations after warm-up." << std::endl;
+        status = 1;
+    }
+
+    return status;
+}
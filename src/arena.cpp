@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "arena.hpp"
+
+using namespace rasterizer;
+
+FrameArena::FrameArena(std::size_t thread_count) : threads(thread_count) {}
+
+void *FrameArena::allocate(std::size_t thread, std::size_t size,
+                           std::size_t alignment)
+{
+    auto &t = threads[thread];
+
+    while (true)
+    {
+        if (t.chunk < t.chunks.size())
+        {
+            const auto &chunk = t.chunks[t.chunk];
+
+            auto base = reinterpret_cast<std::uintptr_t>(chunk.data.get());
+            auto start = (base + t.offset + alignment - 1) & ~(alignment - 1);
+
+            if (start + size <= base + chunk.size)
+            {
+                t.offset = start + size - base;
+                return reinterpret_cast<void *>(start);
+            }
+
+            // The rest of the chunk stays unused until the next reset.
+            t.chunk++;
+            t.offset = 0;
+            continue;
+        }
+
+        // Leave room for aligning the start of the allocation.
+        auto chunk_bytes = std::max(chunk_size, size + alignment);
+        t.chunks.push_back(
+            Chunk{std::make_unique_for_overwrite<std::byte[]>(chunk_bytes),
+                  chunk_bytes});
+        t.allocation_count++;
+    }
+}
+
+void FrameArena::reset()
+{
+    for (auto &t : threads)
+    {
+        t.chunk = 0;
+        t.offset = 0;
+    }
+}
+
+std::size_t FrameArena::get_allocation_count() const
+{
+    std::size_t count = 0;
+    for (const auto &t : threads)
+        count += t.allocation_count;
+
+    return count;
+}
@@ -0,0 +1,133 @@
+// Scratch memory for data that only lives for a single frame.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace rasterizer
+{
+
+// Bump allocator with its own chunks for every thread, so that threads
+// allocate without synchronization. Resetting rewinds every thread to its
+// first chunk but keeps the chunks, so once the arena has grown to fit the
+// largest frame, frames make no heap allocations.
+class FrameArena
+{
+    struct Chunk
+    {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    // Aligned to a cache line, so that threads never share one.
+    struct alignas(64) Thread
+    {
+        std::vector<Chunk> chunks;
+        // Chunk that is allocated from, and the offset of its free space.
+        std::size_t chunk = 0;
+        std::size_t offset = 0;
+        std::size_t allocation_count = 0;
+    };
+
+    std::vector<Thread> threads;
+
+  public:
+    // Allocations larger than a chunk get a chunk of their own.
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    explicit FrameArena(std::size_t thread_count);
+
+    // Returns uninitialized memory that stays valid until reset(). Threads
+    // must only pass their own index, see ThreadPool::Job.
+    void *allocate(std::size_t thread, std::size_t size,
+                   std::size_t alignment);
+
+    template <typename T> T *allocate(std::size_t thread, std::size_t count = 1)
+    {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "The arena never runs destructors.");
+
+        return static_cast<T *>(
+            allocate(thread, count * sizeof(T), alignof(T)));
+    }
+
+    // Frees everything allocated so far in O(threads). Must not be called
+    // while other threads allocate.
+    void reset();
+
+    // Returns the number of chunks allocated from the heap so far.
+    std::size_t get_allocation_count() const;
+};
+
+// Append-only list of values in segments allocated from a FrameArena.
+// Clearing it only forgets the segments, which the arena hands out again
+// after its next reset.
+template <typename T, std::size_t segment_size = 64> class ArenaList
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Values are never destroyed.");
+
+    struct Segment
+    {
+        Segment *next = nullptr;
+        std::size_t count = 0;
+        // Left uninitialized by default-initialization.
+        T values[segment_size];
+    };
+
+    Segment *head = nullptr;
+    Segment *tail = nullptr;
+
+  public:
+    class Iterator
+    {
+        const Segment *segment;
+        std::size_t i;
+
+      public:
+        Iterator(const Segment *segment, std::size_t i)
+            : segment{segment}, i{i}
+        {
+        }
+
+        const T &operator*() const { return segment->values[i]; }
+
+        Iterator &operator++()
+        {
+            if (++i == segment->count)
+            {
+                segment = segment->next;
+                i = 0;
+            }
+
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const = default;
+    };
+
+    bool empty() const { return head == nullptr; }
+    void clear() { head = tail = nullptr; }
+
+    // Allocates a new segment from the arena when the last one is full.
+    void push_back(const T &value, FrameArena &arena, std::size_t thread)
+    {
+        if (!tail || tail->count == segment_size)
+        {
+            auto *segment = new (arena.allocate<Segment>(thread)) Segment;
+            (tail ? tail->next : head) = segment;
+            tail = segment;
+        }
+
+        tail->values[tail->count++] = value;
+    }
+
+    Iterator begin() const { return Iterator{head, 0}; }
+    Iterator end() const { return Iterator{nullptr, 0}; }
+};
+
+} // namespace rasterizer
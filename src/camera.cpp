@@ -10,12 +10,15 @@ Camera::Camera(Vec3 position, Vec3 target, Vec3 up)
 
 void Camera::update(Vec2 delta)
 {
-    const Vec3 right{view[0][0], view[0][1], view[0][2]};
-
     delta *= look_sensitivity;
-    delta.y /= 2.f;
+    orbit(delta.x, delta.y / 2.f);
+}
+
+void Camera::orbit(float yaw, float pitch)
+{
+    const Vec3 right{view[0][0], view[0][1], view[0][2]};
 
-    position = (rotate(rotate(Mat4{1.f}, delta.x, up), delta.y, right) *
+    position = (rotate(rotate(Mat4{1.f}, yaw, up), pitch, right) *
                 Vec4{position, 1.f})
                    .xyz;
 
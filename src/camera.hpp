@@ -21,6 +21,8 @@ class Camera
     Camera(Vec3 position, Vec3 target, Vec3 up = Vec3::up());
 
     void update(Vec2 delta);
+    // Rotates the camera around its target by the given angles in radians.
+    void orbit(float yaw, float pitch);
     void zoom(int direction);
 
     const Mat4 &get_view() const;
@@ -1,32 +1,154 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <memory>
+#include <vector>
+
+// Order of the pixels of a frame buffer in memory.
+enum class FrameLayout
+{
+    // Row after row.
+    linear,
+    // Blocks of frame_block_size x frame_block_size pixels stored row after
+    // row, with the pixels of a block stored contiguously. Pixels that are
+    // close on screen then share cache lines and pages.
+    tiled,
+};
+
+// Width and height in pixels of the blocks of the tiled layout.
+constexpr std::size_t frame_block_size = 8;
 
 template <typename T> class FrameBuffer
 {
     using type = T;
 
+    static constexpr std::size_t b = frame_block_size;
+
     size_t width;
     size_t height;
+    FrameLayout layout;
+    // Number of blocks per row in the tiled layout.
+    size_t blocks_x;
     std::unique_ptr<T[]> buffer;
 
+    std::size_t index(std::size_t x, std::size_t y) const
+    {
+        if (layout == FrameLayout::linear)
+            return x + y * width;
+
+        return (y / b * blocks_x + x / b) * b * b + y % b * b + x % b;
+    }
+
   public:
-    FrameBuffer(std::size_t width, std::size_t height)
-        : width{width}, height{height}, buffer{std::make_unique<T[]>(width *
-                                                                     height)}
+    // Storage index of the first pixel of a block of frame_block_size x
+    // frame_block_size pixels, and the distance between its rows. Rows of a
+    // block are contiguous in both layouts, so loops over the pixels of a
+    // block resolve the layout once per block instead of once per pixel. Frame
+    // buffers of the same size and layout share their blocks.
+    struct Block
+    {
+        std::size_t first;
+        std::size_t pitch;
+
+        // Returns the storage index of pixel (x, y) of the block.
+        std::size_t operator()(std::size_t x, std::size_t y) const
+        {
+            return first + x + y * pitch;
+        }
+    };
+
+    // The tiled layout pads the buffer to whole blocks.
+    FrameBuffer(std::size_t width, std::size_t height,
+                FrameLayout layout = FrameLayout::linear)
+        : width{width}, height{height}, layout{layout},
+          blocks_x{(width + b - 1) / b},
+          buffer{std::make_unique<T[]>(
+              layout == FrameLayout::linear
+                  ? width * height
+                  : blocks_x * ((height + b - 1) / b) * b * b)}
     {
     }
 
     T &operator()(std::size_t x, std::size_t y)
     {
-        return buffer.get()[x + y * width];
+        return buffer.get()[index(x, y)];
+    }
+
+    const T &operator()(std::size_t x, std::size_t y) const
+    {
+        return buffer.get()[index(x, y)];
     }
 
+    // Returns the block whose first pixel is (x, y), which must be multiples
+    // of frame_block_size. In the linear layout, blocks on the right edge
+    // wrap around into the next row.
+    Block block(std::size_t x, std::size_t y) const
+    {
+        return Block{index(x, y), layout == FrameLayout::linear ? width : b};
+    }
+
+    // Storage in the order of the layout.
     T *get() { return buffer.get(); }
+    const T *get() const { return buffer.get(); }
+
+    std::size_t get_width() const { return width; }
+    std::size_t get_height() const { return height; }
+    FrameLayout get_layout() const { return layout; }
 
     void fill(T v)
     {
-        std::fill(buffer.get(), buffer.get() + width * height, v);
+        std::size_t size = layout == FrameLayout::linear
+                               ? width * height
+                               : blocks_x * ((height + b - 1) / b) * b * b;
+
+        std::fill(buffer.get(), buffer.get() + size, v);
+    }
+
+    // Fills the rectangle of w x h pixels at (x, y).
+    void fill(T v, std::size_t x, std::size_t y, std::size_t w, std::size_t h)
+    {
+        for (auto row = y; row < y + h; row++)
+        {
+            // Rows are contiguous within blocks in the tiled layout.
+            for (auto i = x; i < x + w;)
+            {
+                auto run = layout == FrameLayout::linear
+                               ? x + w - i
+                               : std::min(x + w - i, b - i % b);
+                std::fill_n(&(*this)(i, row), run, v);
+                i += run;
+            }
+        }
+    }
+
+    // Copies the pixels in row-major order to out, whose rows start pitch
+    // elements apart.
+    void copy_linear(T *out, std::size_t pitch) const
+    {
+        if (layout == FrameLayout::linear)
+        {
+            for (std::size_t y = 0; y < height; y++)
+                std::copy_n(&(*this)(0, y), width, out + y * pitch);
+
+            return;
+        }
+
+        for (std::size_t y = 0; y < height; y++)
+        {
+            for (std::size_t x = 0; x < width; x += b)
+                std::copy_n(&(*this)(x, y), std::min(b, width - x),
+                            out + y * pitch + x);
+        }
+    }
+
+    // Returns the pixels in row-major order.
+    std::vector<T> to_linear() const
+    {
+        std::vector<T> pixels(width * height);
+        copy_linear(pixels.data(), width);
+
+        return pixels;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,253 @@
+// Offscreen batch renderer that writes frames to disk instead of presenting
+// them in a window. It does not depend on SDL.
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "camera.hpp"
+#include "image.hpp"
+#include "mesh_optimizer.hpp"
+#include "rasterizer.hpp"
+#include "thread_pool.hpp"
+
+using namespace rasterizer;
+
+using std::filesystem::path;
+
+int help(const std::string_view msg)
+{
+    std::cout << msg
+              << "\nUsage: rasterizer_headless model.obj output.(png|ppm|raw)"
+                 "\n    [--texture diffuse.png] [--size WIDTHxHEIGHT]"
+                 "\n    [--filter nearest|bilinear|trilinear]"
+                 "\n    [--shader texture|lambert|normal]"
+                 "\n    [--cull none|back|front]"
+                 "\n    [--frames N] [--depth depth.raw] [--deferred]"
+                 "\n    [--optimize] [--no-cache] [--tiled]"
+                 "\n    [--depth-format float32|unorm24|unorm16] [--reversed-z]"
+              << std::endl;
+    return 1;
+}
+
+// Inserts the frame number before the extension: out.png -> out_0001.png.
+path frame_path(const path &p, int frame)
+{
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+
+    auto result = p;
+    result.replace_filename(p.stem().string() + number +
+                            p.extension().string());
+    return result;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 3)
+        return help("No model or output provided.");
+
+    path model_path{argv[1]};
+    path output_path{argv[2]};
+    path texture_path;
+    path depth_path;
+    auto filter = Texture::Filter::nearest;
+    std::string_view shader_name = "texture";
+    auto cull_mode = CullMode::back;
+    int width = 640;
+    int height = 480;
+    int frame_count = 1;
+
+    bool deferred = false;
+    bool optimized = false;
+    bool cached = true;
+    FrameLayout layout = FrameLayout::linear;
+    auto depth_format = DepthFormat::float32;
+    bool reversed_z = false;
+
+    for (int i = 3; i < argc; i++)
+    {
+        std::string_view arg{argv[i]};
+
+        if (arg == "--deferred")
+        {
+            deferred = true;
+            continue;
+        }
+
+        if (arg == "--optimize")
+        {
+            optimized = true;
+            continue;
+        }
+
+        if (arg == "--no-cache")
+        {
+            cached = false;
+            continue;
+        }
+
+        if (arg == "--tiled")
+        {
+            layout = FrameLayout::tiled;
+            continue;
+        }
+
+        if (arg == "--reversed-z")
+        {
+            reversed_z = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            return help("Missing value for option " + std::string{arg} + ".");
+
+        const char *value = argv[++i];
+
+        if (arg == "--texture")
+            texture_path = value;
+        else if (arg == "--filter")
+        {
+            std::string_view name{value};
+
+            if (name == "nearest")
+                filter = Texture::Filter::nearest;
+            else if (name == "bilinear")
+                filter = Texture::Filter::bilinear;
+            else if (name == "trilinear")
+                filter = Texture::Filter::trilinear;
+            else
+                return help("Invalid filter provided.");
+        }
+        else if (arg == "--shader")
+        {
+            shader_name = value;
+
+            if (shader_name != "texture" && shader_name != "lambert" &&
+                shader_name != "normal")
+                return help("Invalid shader provided.");
+        }
+        else if (arg == "--cull")
+        {
+            std::string_view name{value};
+
+            if (name == "none")
+                cull_mode = CullMode::none;
+            else if (name == "back")
+                cull_mode = CullMode::back;
+            else if (name == "front")
+                cull_mode = CullMode::front;
+            else
+                return help("Invalid cull mode provided.");
+        }
+        else if (arg == "--depth")
+            depth_path = value;
+        else if (arg == "--depth-format")
+        {
+            std::string_view name{value};
+
+            if (name == "float32")
+                depth_format = DepthFormat::float32;
+            else if (name == "unorm24")
+                depth_format = DepthFormat::unorm24;
+            else if (name == "unorm16")
+                depth_format = DepthFormat::unorm16;
+            else
+                return help("Invalid depth format provided.");
+        }
+        else if (arg == "--size")
+        {
+            if (std::sscanf(value, "%dx%d", &width, &height) != 2 ||
+                width <= 0 || height <= 0)
+                return help("Invalid size provided.");
+        }
+        else if (arg == "--frames")
+        {
+            if (std::sscanf(value, "%d", &frame_count) != 1 || frame_count <= 0)
+                return help("Invalid frame count provided.");
+        }
+        else
+            return help("Unknown option " + std::string{arg} + ".");
+    }
+
+    ThreadPool pool;
+    auto model = cached ? Model::from_obj_cached(model_path, pool)
+                        : Model::from_obj(model_path, pool);
+
+    if (optimized)
+    {
+        auto report = optimize(*model.mesh);
+        std::cout << "ACMR " << report.acmr_before << " -> "
+                  << report.acmr_after << std::endl;
+    }
+
+    if (!texture_path.empty())
+    {
+        auto diffuse = Texture::from_file(texture_path);
+        if (!diffuse.has_value())
+            return help("Invalid diffuse texture provided.");
+
+        diffuse->filter = filter;
+        model.diffuse_texture = std::make_unique<Texture>(std::move(*diffuse));
+    }
+
+    LambertShader lambert;
+    lambert.uniforms.texture = model.diffuse_texture.get();
+
+    Rasterizer rasterizer{width, height, std::move(model), layout};
+
+    if (deferred)
+        rasterizer.set_shading_mode(ShadingMode::deferred);
+    rasterizer.set_cull_mode(cull_mode);
+    rasterizer.set_depth_format(depth_format);
+    rasterizer.set_reversed_z(reversed_z);
+    Camera camera{Vec3{0.f, 2.f, 2.f}, Vec3{0.f}};
+
+    // Multiple frames orbit the camera once around the model.
+    const float step = 2.f * std::numbers::pi_v<float> / frame_count;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int frame = 0; frame < frame_count; frame++)
+    {
+        rasterizer.clear();
+
+        if (shader_name == "lambert")
+            rasterizer.draw(camera, lambert);
+        else if (shader_name == "normal")
+            rasterizer.draw(camera, NormalShader{});
+        else
+            rasterizer.draw(camera);
+
+        bool numbered = frame_count > 1;
+
+        write_image(numbered ? frame_path(output_path, frame) : output_path,
+                    rasterizer.get_color_buffer());
+
+        if (!depth_path.empty())
+            std::visit(
+                [&](const auto &depth)
+                {
+                    write_depth(numbered ? frame_path(depth_path, frame)
+                                         : depth_path,
+                                depth);
+                },
+                rasterizer.get_depth_buffer());
+
+        camera.orbit(step, 0.f);
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << frame_count << " frames in " << elapsed.count() << " s ("
+              << frame_count / elapsed.count() << " fps)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "image.hpp"
+
+using std::filesystem::path;
+
+namespace rasterizer
+{
+
+static std::ofstream open_output(const path &path)
+{
+    std::ofstream fs(path, std::ios::binary);
+    if (!fs.is_open())
+        throw std::runtime_error{"Error while opening file: " + path.string()};
+
+    return fs;
+}
+
+void write_image(const path &path, const FrameBuffer<Color8> &buffer)
+{
+    const auto width = buffer.get_width();
+    const auto height = buffer.get_height();
+    const auto linear = buffer.to_linear();
+    const auto *pixels = reinterpret_cast<const uint8_t *>(linear.data());
+
+    const auto extension = path.extension();
+
+    if (extension == ".png")
+    {
+        if (!stbi_write_png(path.c_str(), width, height, 4, pixels,
+                            width * sizeof(Color8)))
+            throw std::runtime_error{"Error while writing file: " +
+                                     path.string()};
+
+        return;
+    }
+
+    auto fs = open_output(path);
+
+    if (extension == ".ppm")
+    {
+        fs << "P6\n" << width << " " << height << "\n255\n";
+
+        // PPM has no alpha channel.
+        std::vector<uint8_t> row(3 * width);
+
+        for (size_t y = 0; y < height; y++)
+        {
+            for (size_t x = 0; x < width; x++)
+                for (size_t c = 0; c < 3; c++)
+                    row[3 * x + c] = pixels[4 * (x + y * width) + c];
+
+            fs.write(reinterpret_cast<const char *>(row.data()), row.size());
+        }
+    }
+    else
+    {
+        fs.write(reinterpret_cast<const char *>(pixels),
+                 width * height * sizeof(Color8));
+    }
+
+    if (fs.bad())
+        throw std::runtime_error{"Error while writing file: " + path.string()};
+}
+
+template <typename T>
+static void write_raw(const path &path, const FrameBuffer<T> &buffer)
+{
+    auto fs = open_output(path);
+
+    const auto linear = buffer.to_linear();
+    fs.write(reinterpret_cast<const char *>(linear.data()),
+             linear.size() * sizeof(T));
+
+    if (fs.bad())
+        throw std::runtime_error{"Error while writing file: " + path.string()};
+}
+
+void write_depth(const path &path, const FrameBuffer<float> &buffer)
+{
+    write_raw(path, buffer);
+}
+
+void write_depth(const path &path, const FrameBuffer<std::uint32_t> &buffer)
+{
+    write_raw(path, buffer);
+}
+
+void write_depth(const path &path, const FrameBuffer<std::uint16_t> &buffer)
+{
+    write_raw(path, buffer);
+}
+
+} // namespace rasterizer
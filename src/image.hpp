@@ -0,0 +1,28 @@
+// Writing frame buffers to disk for offscreen rendering.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "frame_buffer.hpp"
+#include "vector.hpp"
+
+namespace rasterizer
+{
+
+// Writes the color buffer to the given path. The format follows from the
+// file extension: .png, .ppm (binary P6) or anything else for raw RGBA8.
+void write_image(const std::filesystem::path &path,
+                 const FrameBuffer<Color8> &buffer);
+
+// Writes the depth buffer as raw native-endian values of its format, row by
+// row: 32-bit floats, or 32-bit or 16-bit unsigned integers.
+void write_depth(const std::filesystem::path &path,
+                 const FrameBuffer<float> &buffer);
+void write_depth(const std::filesystem::path &path,
+                 const FrameBuffer<std::uint32_t> &buffer);
+void write_depth(const std::filesystem::path &path,
+                 const FrameBuffer<std::uint16_t> &buffer);
+
+} // namespace rasterizer
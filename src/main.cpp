@@ -3,7 +3,8 @@
 #include <memory>
 #include <string_view>
 
-#include "rasterizer.hpp"
+#include "thread_pool.hpp"
+#include "viewer.hpp"
 
 using namespace rasterizer;
 
@@ -20,7 +21,8 @@ int main(int argc, const char *argv[])
 {
     if (argc >= 2)
     {
-        auto model = Model::from_obj(path{argv[1]});
+        ThreadPool pool;
+        auto model = Model::from_obj_cached(path{argv[1]}, pool);
 
         if (argc == 3)
         {
@@ -32,8 +34,8 @@ int main(int argc, const char *argv[])
                 return help("Invalid diffuse texture provided.");
         }
 
-        Rasterizer rasterizer{640, 480, std::move(model)};
-        rasterizer.run();
+        Viewer viewer{640, 480, std::move(model)};
+        viewer.run();
 
         return 0;
     }
@@ -0,0 +1,52 @@
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+using namespace rasterizer;
+
+MappedFile::MappedFile(const std::filesystem::path &path, Access access)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error{"Error while opening file: " + path.string()};
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::runtime_error{"Error while reading file: " + path.string()};
+    }
+
+    size = static_cast<std::size_t>(st.st_size);
+
+    // Mapping an empty file fails, but there is nothing to map anyway.
+    if (size > 0)
+    {
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error{"Error while mapping file: " +
+                                     path.string()};
+        }
+
+        madvise(p, size,
+                access == Access::sequential ? MADV_SEQUENTIAL
+                                             : MADV_WILLNEED);
+        data = static_cast<const char *>(p);
+    }
+
+    // The mapping stays valid after closing the descriptor.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr)
+        munmap(const_cast<char *>(data), size);
+}
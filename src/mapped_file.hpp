@@ -0,0 +1,42 @@
+// Read-only memory mapping of a whole file.
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace rasterizer
+{
+
+class MappedFile
+{
+  public:
+    // How the mapping will be read, which the kernel uses to plan paging.
+    enum class Access
+    {
+        // Pages are read ahead and dropped once they are behind the reader.
+        sequential,
+        // Pages are read in whole up front and stay, for reads in any order.
+        random,
+    };
+
+  private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+
+  public:
+    // Throws std::runtime_error when the file can't be opened or mapped.
+    explicit MappedFile(const std::filesystem::path &path,
+                        Access access);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const char *get() const { return data; }
+    std::size_t get_size() const { return size; }
+
+    std::string_view view() const { return {data, size}; }
+};
+
+} // namespace rasterizer
@@ -6,6 +6,7 @@
 #include <cmath>
 #include <iostream>
 #include <ostream>
+#include <type_traits>
 
 #include "vector.hpp"
 
@@ -19,7 +20,10 @@ namespace rasterizer
 
 template <typename T, size_t m, size_t n, T... d> struct Matrix
 {
-    array<array<T, n>, m> data;
+    // Rows of four floats are aligned for SSE, see is_simd.
+    static constexpr bool simd_rows = is_simd<Vector<T, n>>;
+
+    alignas(simd_rows ? 16 : alignof(T)) array<array<T, n>, m> data;
 
     constexpr Matrix() = default;
 
@@ -93,6 +97,31 @@ template <typename T, size_t m, size_t n, T... d> struct Matrix
     {
         Matrix<T, m, p> res{};
 
+#ifdef __SSE__
+        if constexpr (simd_rows && p == 4)
+        {
+            if (!std::is_constant_evaluated())
+            {
+                // Every row of the result is a linear combination of the
+                // rows of m2. Products are summed in the same order as in the
+                // loop below.
+                for (size_t i = 0; i < m; i++)
+                {
+                    __m128 row = _mm_setzero_ps();
+
+                    for (size_t k = 0; k < n; k++)
+                        row = _mm_add_ps(
+                            row, _mm_mul_ps(_mm_set1_ps(m1.data[i][k]),
+                                            _mm_load_ps(m2.data[k].data())));
+
+                    _mm_store_ps(res.data[i].data(), row);
+                }
+
+                return res;
+            }
+        }
+#endif
+
         for (size_t i = 0; i < m; i++)
             for (size_t j = 0; j < p; j++)
                 for (size_t k = 0; k < n; k++)
@@ -106,6 +135,29 @@ template <typename T, size_t m, size_t n, T... d> struct Matrix
     {
         Vector<T, m> res{};
 
+#ifdef __SSE__
+        if constexpr (simd_rows && m == 4)
+        {
+            if (!std::is_constant_evaluated())
+            {
+                // Transpose to columns, such that the result is a linear
+                // combination of the columns.
+                __m128 columns[4];
+                for (size_t i = 0; i < m; i++)
+                    columns[i] = _mm_load_ps(mat.data[i].data());
+                _MM_TRANSPOSE4_PS(columns[0], columns[1], columns[2],
+                                  columns[3]);
+
+                __m128 sum = _mm_setzero_ps();
+                for (size_t j = 0; j < n; j++)
+                    sum = _mm_add_ps(
+                        sum, _mm_mul_ps(columns[j], _mm_set1_ps(vec[j])));
+
+                return res.store(sum);
+            }
+        }
+#endif
+
         for (size_t i = 0; i < m; i++)
             for (size_t j = 0; j < n; j++)
                 res[i] += mat[i][j] * vec[j];
@@ -205,15 +257,26 @@ Matrix<T, 4, 4> frustrum(const T &left, const T &right, const T &bottom,
 }
 
 // Perspective projection
-// Vertical fov.
+// Vertical fov. Depth ranges from -1 at the near plane to 1 at the far plane,
+// or from 1 to 0 with reversed-Z.
+// https://developer.nvidia.com/content/depth-precision-visualized
 template <typename T>
 Matrix<T, 4, 4> perspective(const T &fov, const T &aspect, const T &near,
-                            const T &far)
+                            const T &far, bool reversed_z = false)
 {
     auto top = near * tanf(fov / 2);
     auto right = top * aspect;
 
-    return frustrum(-right, right, -top, top, near, far);
+    auto m = frustrum(-right, right, -top, top, near, far);
+
+    if (reversed_z)
+    {
+        auto fn = far - near;
+        m[2][2] = near / fn;
+        m[2][3] = far * near / fn;
+    }
+
+    return m;
 }
 
 // https://docs.gl/gl3/glOrtho
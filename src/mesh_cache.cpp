@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
+
+using std::uint32_t;
+using std::uint64_t;
+using std::filesystem::path;
+
+namespace rasterizer
+{
+
+constexpr char mesh_file_magic[8] = "RMESH\r\n";
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + mesh_stream_alignment - 1) / mesh_stream_alignment *
+           mesh_stream_alignment;
+}
+
+void write_mesh_file(const path &file_path, const Mesh &mesh,
+                     const path &source)
+{
+    MeshFileHeader header{};
+    std::memcpy(header.magic, mesh_file_magic, sizeof(header.magic));
+    header.version = mesh_file_version;
+    header.vertex_size = sizeof(Vertex);
+    header.source_size = std::filesystem::file_size(source);
+    header.source_time =
+        std::filesystem::last_write_time(source).time_since_epoch().count();
+    header.vertex_count = mesh.vertices.size();
+    header.vertex_offset = align(sizeof(header));
+    header.index_count = mesh.indices.size();
+    header.index_offset =
+        align(header.vertex_offset + mesh.vertices.size_bytes());
+    header.bounds = mesh.bounds;
+
+    // Processes and threads that convert the same file at once each write
+    // their own temporary file. The last rename wins, and every rename
+    // replaces a complete file.
+    static std::atomic<uint64_t> temp_count{0};
+
+    auto temp_path = file_path;
+    temp_path += ".tmp." + std::to_string(getpid()) + "." +
+                 std::to_string(temp_count++);
+
+    try
+    {
+        std::ofstream out{temp_path, std::ios::binary | std::ios::trunc};
+        if (!out.is_open())
+            throw std::runtime_error{"Error while opening file: " +
+                                     temp_path.string()};
+
+        const char padding[mesh_stream_alignment]{};
+
+        auto write_at = [&](uint64_t offset, const void *data, size_t size)
+        {
+            out.write(padding, offset - static_cast<uint64_t>(out.tellp()));
+            out.write(static_cast<const char *>(data), size);
+        };
+
+        write_at(0, &header, sizeof(header));
+        write_at(header.vertex_offset, mesh.vertices.data(),
+                 mesh.vertices.size_bytes());
+        write_at(header.index_offset, mesh.indices.data(),
+                 mesh.indices.size_bytes());
+
+        // Closing flushes, which may fail too.
+        out.close();
+        if (!out)
+            throw std::runtime_error{"Error while writing file: " +
+                                     temp_path.string()};
+
+        std::filesystem::rename(temp_path, file_path);
+    }
+    catch (...)
+    {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        throw;
+    }
+}
+
+std::unique_ptr<Mesh> read_mesh_file(const path &file_path,
+                                     const path &source)
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(file_path, ec))
+        return nullptr;
+
+    std::shared_ptr<MappedFile> file;
+
+    try
+    {
+        // Draws index the vertices in any order, every frame.
+        file = std::make_shared<MappedFile>(file_path,
+                                            MappedFile::Access::random);
+    }
+    catch (const std::runtime_error &)
+    {
+        return nullptr;
+    }
+
+    MeshFileHeader header;
+    if (file->get_size() < sizeof(header))
+        return nullptr;
+
+    std::memcpy(&header, file->get(), sizeof(header));
+
+    auto source_size = std::filesystem::file_size(source, ec);
+    if (ec)
+        return nullptr;
+
+    auto source_time = std::filesystem::last_write_time(source, ec);
+    if (ec)
+        return nullptr;
+
+    if (std::memcmp(header.magic, mesh_file_magic, sizeof(header.magic)) != 0 ||
+        header.version != mesh_file_version ||
+        header.vertex_size != sizeof(Vertex) ||
+        header.source_size != source_size ||
+        header.source_time != source_time.time_since_epoch().count())
+        return nullptr;
+
+    // Offsets and counts must stay within the file. Checking them one by one
+    // avoids overflow for corrupt headers.
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t size)
+    {
+        return offset % mesh_stream_alignment == 0 &&
+               offset <= file->get_size() &&
+               count <= (file->get_size() - offset) / size;
+    };
+
+    if (!fits(header.vertex_offset, header.vertex_count, sizeof(Vertex)) ||
+        !fits(header.index_offset, header.index_count, sizeof(uint32_t)) ||
+        header.index_count % 3 != 0)
+        return nullptr;
+
+    // Mappings are page aligned, which keeps the streams aligned in memory.
+    auto *vertices =
+        reinterpret_cast<const Vertex *>(file->get() + header.vertex_offset);
+    auto *indices =
+        reinterpret_cast<const uint32_t *>(file->get() + header.index_offset);
+
+    // Draws trust the indices, so a corrupt file must not get past here.
+    if (std::any_of(indices, indices + header.index_count,
+                    [&](uint32_t i) { return i >= header.vertex_count; }))
+        return nullptr;
+
+    return std::make_unique<Mesh>(
+        std::span{vertices, header.vertex_count},
+        std::span{indices, header.index_count}, header.bounds, std::move(file));
+}
+
+} // namespace rasterizer
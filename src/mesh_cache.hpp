@@ -0,0 +1,57 @@
+// Binary mesh files that can be memory mapped and rendered from directly.
+//
+// A file starts with a MeshFileHeader, followed by the vertex and index
+// streams at 64-byte aligned offsets. All values are stored in the byte order
+// of the machine that wrote the file.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+#include "model.hpp"
+
+namespace rasterizer
+{
+
+// Incremented whenever the layout of the file or of Vertex changes.
+constexpr std::uint32_t mesh_file_version = 1;
+
+// Alignment of the vertex and index streams within the file.
+constexpr std::uint64_t mesh_stream_alignment = 64;
+
+struct MeshFileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t vertex_size;
+
+    // Size and modification time, in ticks of the file clock, of the file the
+    // mesh was converted from. Used to detect stale caches.
+    std::uint64_t source_size;
+    std::int64_t source_time;
+
+    std::uint64_t vertex_count;
+    std::uint64_t vertex_offset;
+    std::uint64_t index_count;
+    std::uint64_t index_offset;
+
+    Bounds bounds;
+};
+
+// Writes the mesh to a binary file, recording the size and modification time
+// of the given source file. The file is written under a temporary name that
+// is unique to the process and call first, so that readers never see a
+// partial file, even while other processes write it too. Throws
+// std::runtime_error on failure.
+void write_mesh_file(const std::filesystem::path &path, const Mesh &mesh,
+                     const std::filesystem::path &source);
+
+// Maps a binary mesh file and returns a mesh referring to the mapping.
+// Returns nullptr if the file is missing, invalid, has indices out of range
+// or was written for a different version of the source file.
+std::unique_ptr<Mesh> read_mesh_file(const std::filesystem::path &path,
+                                     const std::filesystem::path &source);
+
+} // namespace rasterizer
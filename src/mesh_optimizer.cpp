@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "mesh_optimizer.hpp"
+
+using std::uint32_t;
+using std::vector;
+
+namespace rasterizer
+{
+
+// Simulates a FIFO cache through insertion timestamps: a vertex is cached if
+// it was inserted during the last cache_size insertions.
+class FifoCache
+{
+    vector<uint32_t> timestamps;
+    uint32_t time;
+    std::size_t size;
+
+  public:
+    FifoCache(std::size_t vertex_count, std::size_t cache_size)
+        : timestamps(vertex_count, 0),
+          time{static_cast<uint32_t>(cache_size) + 1}, size{cache_size}
+    {
+    }
+
+    // Returns whether accessing the vertex was a miss.
+    bool access(uint32_t v)
+    {
+        if (time - timestamps[v] <= size)
+            return false;
+
+        timestamps[v] = time++;
+        return true;
+    }
+
+    void flush() { time += size + 1; }
+};
+
+float acmr(std::span<const uint32_t> indices, std::size_t vertex_count,
+           std::size_t cache_size)
+{
+    if (indices.empty())
+        return 0.f;
+
+    FifoCache cache{vertex_count, cache_size};
+    std::size_t misses = 0;
+
+    for (auto i : indices)
+        misses += cache.access(i);
+
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Scoring parameters as suggested by Forsyth.
+constexpr int forsyth_cache_size = 32;
+constexpr float last_triangle_score = 0.75f;
+constexpr float cache_decay_power = 1.5f;
+constexpr float valence_boost_scale = 2.f;
+constexpr float valence_boost_power = 0.5f;
+
+static float vertex_score(int cache_position, uint32_t remaining)
+{
+    // Vertices without remaining triangles are never used again.
+    if (remaining == 0)
+        return -1.f;
+
+    float score = 0.f;
+
+    if (cache_position >= 0)
+    {
+        // The most recent triangle gets a fixed score, so that the next one
+        // doesn't just continue a strip.
+        if (cache_position < 3)
+            score = last_triangle_score;
+        else
+            score = std::pow(1.f - static_cast<float>(cache_position - 3) /
+                                       (forsyth_cache_size - 3),
+                             cache_decay_power);
+    }
+
+    // Boost vertices with few triangles left, to get rid of lone triangles.
+    return score + valence_boost_scale *
+                       std::pow(static_cast<float>(remaining),
+                                -valence_boost_power);
+}
+
+void optimize_vertex_cache(vector<uint32_t> &indices, std::size_t vertex_count)
+{
+    const std::size_t triangle_count = indices.size() / 3;
+
+    if (triangle_count == 0)
+        return;
+
+    // Triangles adjacent to each vertex, in compressed row storage. The first
+    // remaining[v] entries of a vertex are the triangles not emitted yet.
+    vector<uint32_t> remaining(vertex_count, 0);
+    for (auto i : indices)
+        remaining[i]++;
+
+    vector<uint32_t> offsets(vertex_count + 1, 0);
+    std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+
+    vector<uint32_t> adjacency(indices.size());
+    {
+        vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (std::size_t t = 0; t < triangle_count; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[3 * t + k]]++] = t;
+    }
+
+    vector<int> cache_position(vertex_count, -1);
+    vector<float> score(vertex_count);
+    for (std::size_t v = 0; v < vertex_count; v++)
+        score[v] = vertex_score(-1, remaining[v]);
+
+    vector<float> triangle_score(triangle_count);
+    for (std::size_t t = 0; t < triangle_count; t++)
+        triangle_score[t] = score[indices[3 * t]] +
+                            score[indices[3 * t + 1]] +
+                            score[indices[3 * t + 2]];
+
+    vector<bool> emitted(triangle_count, false);
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    // Holds three more entries for the vertices of the emitted triangle.
+    vector<uint32_t> cache;
+    vector<uint32_t> next_cache;
+    cache.reserve(forsyth_cache_size + 3);
+    next_cache.reserve(forsyth_cache_size + 3);
+
+    std::size_t cursor = 0;
+    std::size_t best = 0;
+
+    for (std::size_t emit_count = 0; emit_count < triangle_count; emit_count++)
+    {
+        // Without candidates in the cache, fall back to the next triangle in
+        // the original order.
+        if (best == std::numeric_limits<std::size_t>::max())
+        {
+            while (emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+
+        emitted[best] = true;
+
+        next_cache.clear();
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[3 * best + k];
+            result.push_back(v);
+            next_cache.push_back(v);
+
+            // Remove the triangle from the remaining triangles of the vertex.
+            auto first = adjacency.begin() + offsets[v];
+            auto last = first + remaining[v];
+            std::iter_swap(std::find(first, last, best), last - 1);
+            remaining[v]--;
+        }
+
+        for (auto v : cache)
+            if (std::find(next_cache.begin(), next_cache.begin() + 3, v) ==
+                next_cache.begin() + 3)
+                next_cache.push_back(v);
+
+        for (std::size_t i = forsyth_cache_size; i < next_cache.size(); i++)
+            cache_position[next_cache[i]] = -1;
+
+        if (next_cache.size() > forsyth_cache_size)
+            next_cache.resize(forsyth_cache_size);
+
+        std::swap(cache, next_cache);
+
+        for (std::size_t i = 0; i < cache.size(); i++)
+            cache_position[cache[i]] = i;
+
+        // Update the scores of affected triangles and find the best one.
+        best = std::numeric_limits<std::size_t>::max();
+        float best_score = -1.f;
+
+        for (auto v : cache)
+        {
+            float new_score = vertex_score(cache_position[v], remaining[v]);
+            float delta = new_score - score[v];
+            score[v] = new_score;
+
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                auto t = adjacency[offsets[v] + i];
+                triangle_score[t] += delta;
+
+                if (triangle_score[t] > best_score)
+                {
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+
+        // Vertices pushed out of the cache lose their cache score.
+        for (auto v : next_cache)
+        {
+            if (cache_position[v] >= 0)
+                continue;
+
+            float new_score = vertex_score(-1, remaining[v]);
+            float delta = new_score - score[v];
+            score[v] = new_score;
+
+            for (uint32_t i = 0; i < remaining[v]; i++)
+                triangle_score[adjacency[offsets[v] + i]] += delta;
+        }
+    }
+
+    indices = std::move(result);
+}
+
+void optimize_overdraw(vector<uint32_t> &indices,
+                       std::span<const Vertex> vertices, float threshold)
+{
+    const std::size_t triangle_count = indices.size() / 3;
+
+    if (triangle_count == 0)
+        return;
+
+    vector<uint32_t> misses(triangle_count);
+    {
+        FifoCache cache{vertices.size(), vertex_cache_size};
+
+        for (std::size_t t = 0; t < triangle_count; t++)
+            for (int k = 0; k < 3; k++)
+                misses[t] += cache.access(indices[3 * t + k]);
+    }
+
+    // Hard boundaries lie where the cache optimizer started over, which shows
+    // as a triangle with three misses.
+    vector<std::size_t> hard_boundaries;
+    for (std::size_t t = 0; t < triangle_count; t++)
+        if (t == 0 || misses[t] == 3)
+            hard_boundaries.push_back(t);
+    hard_boundaries.push_back(triangle_count);
+
+    // Soft boundaries split hard clusters further wherever the ACMR of the
+    // part so far is within the threshold of the ACMR of the whole cluster.
+    // Every cluster restarts with a cold cache, which is what costs ACMR.
+    vector<std::size_t> clusters;
+
+    for (std::size_t c = 0; c + 1 < hard_boundaries.size(); c++)
+    {
+        std::size_t first = hard_boundaries[c];
+        std::size_t last = hard_boundaries[c + 1];
+
+        std::size_t cluster_misses = 0;
+        for (auto t = first; t < last; t++)
+            cluster_misses += misses[t];
+
+        float cluster_threshold =
+            threshold * cluster_misses / static_cast<float>(last - first);
+
+        FifoCache cache{vertices.size(), vertex_cache_size};
+        std::size_t start = first;
+        std::size_t start_misses = 0;
+
+        clusters.push_back(first);
+
+        for (auto t = first; t < last; t++)
+        {
+            for (int k = 0; k < 3; k++)
+                start_misses += cache.access(indices[3 * t + k]);
+
+            if (t + 1 < last &&
+                start_misses / static_cast<float>(t + 1 - start) <=
+                    cluster_threshold)
+            {
+                clusters.push_back(t + 1);
+                start = t + 1;
+                start_misses = 0;
+                cache.flush();
+            }
+        }
+    }
+
+    clusters.push_back(triangle_count);
+
+    // Area weighted centroid and normal of every cluster and of the mesh.
+    auto triangle = [&](std::size_t t, Vec3 &centroid, Vec3 &normal)
+    {
+        const auto &p0 = vertices[indices[3 * t]].position;
+        const auto &p1 = vertices[indices[3 * t + 1]].position;
+        const auto &p2 = vertices[indices[3 * t + 2]].position;
+
+        // Twice the area in magnitude, pointing outwards for counterclockwise
+        // triangles.
+        normal = cross(p1 - p0, p2 - p0);
+        centroid = (p0 + p1 + p2) / 3.f;
+    };
+
+    Vec3 mesh_centroid{0.f};
+    float mesh_area = 0.f;
+
+    vector<Vec3> centroids(clusters.size() - 1, Vec3{0.f});
+    vector<Vec3> normals(clusters.size() - 1, Vec3{0.f});
+
+    for (std::size_t c = 0; c + 1 < clusters.size(); c++)
+    {
+        float area = 0.f;
+
+        for (auto t = clusters[c]; t < clusters[c + 1]; t++)
+        {
+            Vec3 centroid{0.f}, normal{0.f};
+            triangle(t, centroid, normal);
+
+            float a = normal.magnitude();
+            centroids[c] += centroid * a;
+            normals[c] += normal;
+            area += a;
+        }
+
+        mesh_centroid += centroids[c];
+        mesh_area += area;
+
+        if (area > 0.f)
+            centroids[c] /= area;
+    }
+
+    if (mesh_area > 0.f)
+        mesh_centroid /= mesh_area;
+
+    // Clusters pointing away from the mesh center are likely to occlude the
+    // others, so they are drawn first.
+    vector<float> keys(centroids.size());
+    for (std::size_t c = 0; c < keys.size(); c++)
+    {
+        float length = normals[c].magnitude();
+        keys[c] = length > 0.f
+                      ? dot(centroids[c] - mesh_centroid, normals[c]) / length
+                      : 0.f;
+    }
+
+    vector<std::size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](auto a, auto b) { return keys[a] > keys[b]; });
+
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    for (auto c : order)
+        result.insert(result.end(), indices.begin() + 3 * clusters[c],
+                      indices.begin() + 3 * clusters[c + 1]);
+
+    indices = std::move(result);
+}
+
+void optimize_vertex_fetch(vector<uint32_t> &indices, vector<Vertex> &vertices)
+{
+    constexpr auto unused = std::numeric_limits<uint32_t>::max();
+
+    vector<uint32_t> remap(vertices.size(), unused);
+    vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (auto &i : indices)
+    {
+        if (remap[i] == unused)
+        {
+            remap[i] = result.size();
+            result.push_back(vertices[i]);
+        }
+
+        i = remap[i];
+    }
+
+    vertices = std::move(result);
+}
+
+OptimizationReport optimize(Mesh &mesh)
+{
+    vector<Vertex> vertices(mesh.vertices.begin(), mesh.vertices.end());
+    vector<uint32_t> indices(mesh.indices.begin(), mesh.indices.end());
+
+    OptimizationReport report{};
+    report.acmr_before = acmr(indices, vertices.size());
+
+    optimize_vertex_cache(indices, vertices.size());
+    optimize_overdraw(indices, vertices);
+    optimize_vertex_fetch(indices, vertices);
+
+    report.acmr_after = acmr(indices, vertices.size());
+
+    mesh = Mesh{std::move(vertices), std::move(indices)};
+    return report;
+}
+
+} // namespace rasterizer
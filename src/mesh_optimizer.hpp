@@ -0,0 +1,56 @@
+// Reordering of mesh triangles and vertices for faster rendering.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "model.hpp"
+
+namespace rasterizer
+{
+
+// Size of the FIFO post-transform vertex cache that is simulated to measure
+// and optimize vertex locality.
+constexpr std::size_t vertex_cache_size = 16;
+
+struct OptimizationReport
+{
+    // Average cache miss ratio (transformed vertices per triangle) before and
+    // after optimization. It lies between 0.5 and 3, lower is better.
+    float acmr_before;
+    float acmr_after;
+};
+
+// Returns the average cache miss ratio of the index buffer for a FIFO vertex
+// cache of the given size.
+float acmr(std::span<const std::uint32_t> indices, std::size_t vertex_count,
+           std::size_t cache_size = vertex_cache_size);
+
+// Reorders triangles for post-transform vertex cache hits using Tom
+// Forsyth's linear-speed vertex cache optimization.
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+void optimize_vertex_cache(std::vector<std::uint32_t> &indices,
+                           std::size_t vertex_count);
+
+// Reorders clusters of triangles such that triangles facing outwards come
+// first, which approximates front-to-back order from any viewpoint. Expects
+// a cache optimized mesh, whose ACMR is allowed to get worse by the given
+// factor. Follows Sander et al., Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw.
+// https://gfx.cs.princeton.edu/pubs/Sander_2007_%3ETR/tipsy.pdf
+void optimize_overdraw(std::vector<std::uint32_t> &indices,
+                       std::span<const Vertex> vertices,
+                       float threshold = 1.05f);
+
+// Reorders vertices by first use in the index buffer, so that vertex reads
+// are mostly sequential. Unreferenced vertices are removed.
+void optimize_vertex_fetch(std::vector<std::uint32_t> &indices,
+                           std::vector<Vertex> &vertices);
+
+// Runs all of the above in order and replaces the mesh with the result.
+OptimizationReport optimize(Mesh &mesh);
+
+} // namespace rasterizer
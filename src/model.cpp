@@ -1,24 +1,29 @@
 
+#include <charconv>
+#include <cmath>
 #include <cstdint>
-#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <optional>
-#include <sstream>
 #include <stdexcept>
 #include <sys/types.h>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
 #include "model.hpp"
+#include "thread_pool.hpp"
 #include "vector.hpp"
 
 using std::byte;
 using std::clamp;
-using std::istringstream;
 using std::optional;
 using std::string;
 using std::string_view;
@@ -28,140 +33,641 @@ using std::filesystem::path;
 namespace rasterizer
 {
 
-Texture::Texture(int width, int height, int channel_count,
-                 std::unique_ptr<uint8_t> data)
-    : width{width}, height{height},
-      channel_count{channel_count}, data{std::move(data)}
+Mesh::Mesh(vector<Vertex> vertices, vector<uint32_t> indices)
 {
+    struct Owned
+    {
+        vector<Vertex> vertices;
+        vector<uint32_t> indices;
+    };
+
+    auto owned =
+        std::make_shared<Owned>(std::move(vertices), std::move(indices));
+
+    this->vertices = owned->vertices;
+    this->indices = owned->indices;
+    storage = std::move(owned);
+
+    const float inf = std::numeric_limits<float>::infinity();
+    bounds = Bounds{Vec3{inf}, Vec3{-inf}};
+
+    for (const auto &v : this->vertices)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            bounds.min[i] = std::min(bounds.min[i], v.position[i]);
+            bounds.max[i] = std::max(bounds.max[i], v.position[i]);
+        }
+    }
 }
 
-Color8 Texture::operator()(float u, float v) const
+Mesh::Mesh(std::span<const Vertex> vertices,
+           std::span<const uint32_t> indices, Bounds bounds,
+           std::shared_ptr<const void> storage)
+    : storage{std::move(storage)}, vertices{vertices}, indices{indices},
+      bounds{bounds}
 {
-    return (*this)(static_cast<int>(round(u * width - 0.5)),
-                   static_cast<int>(round(v * height - 0.5)));
 }
 
-Color8 Texture::operator()(Vec2 c) const { return (*this)(c.x, c.y); }
+// Returns the index of texel (x, y) in a level with the given layout and
+// pitch.
+template <Texture::Layout layout>
+static size_t texel_index(int pitch, int x, int y)
+{
+    using Layout = Texture::Layout;
 
-Color8 Texture::operator()(int x, int y) const
+    if constexpr (layout == Layout::linear)
+        return static_cast<size_t>(y) * pitch + x;
+    else if constexpr (layout == Layout::tiled)
+    {
+        size_t block = static_cast<size_t>(y >> 2) * pitch + (x >> 2);
+        return block * 16 + (y & 3) * 4 + (x & 3);
+    }
+    else
+    {
+        // Interleave the lower three bits of x and y, x in the even bits.
+        auto spread = [](int v)
+        { return (v & 1) | (v & 2) << 1 | (v & 4) << 2; };
+
+        size_t block = static_cast<size_t>(y >> 3) * pitch + (x >> 3);
+        return block * 64 + (spread(x & 7) | spread(y & 7) << 1);
+    }
+}
+
+// Calls f with the layout and wrap mode as std::integral_constant, so that
+// it can be specialized on both at compile time.
+template <typename F>
+static auto dispatch(Texture::Layout layout, Texture::WrapMode mode, F f)
 {
-    switch (mode)
+    using Layout = Texture::Layout;
+    using WrapMode = Texture::WrapMode;
+
+    auto with_mode = [&](auto l)
     {
-    case WrapMode::repeat:
-        x = abs(x % width);
-        y = abs(y % height);
-        break;
-    case WrapMode::clamp:
-        x = clamp(x, 0, width - 1);
-        y = clamp(y, 0, height - 1);
+        if (mode == WrapMode::clamp)
+            return f(l, std::integral_constant<WrapMode, WrapMode::clamp>{});
+        return f(l, std::integral_constant<WrapMode, WrapMode::repeat>{});
+    };
+
+    switch (layout)
+    {
+    case Layout::linear:
+        return with_mode(std::integral_constant<Layout, Layout::linear>{});
+    case Layout::tiled:
+        return with_mode(std::integral_constant<Layout, Layout::tiled>{});
+    case Layout::morton:
         break;
     }
 
-    uint8_t *pixel = data.get() + (y * width + x) * channel_count;
+    return with_mode(std::integral_constant<Layout, Layout::morton>{});
+}
+
+Texture::Texture(int width, int height, const Color8 *pixels, Layout layout)
+    : layout{layout}
+{
+    levels.push_back(MipLevel{
+        width, height, width,
+        vector<Color8>(pixels, pixels + static_cast<size_t>(width) * height)});
+
+    // Every level is a 2x2 box filter of the previous one. Odd dimensions
+    // drop their last row or column.
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        const auto &src = levels.back();
+
+        MipLevel dst{std::max(src.width / 2, 1), std::max(src.height / 2, 1),
+                     0, {}};
+        dst.pitch = dst.width;
+        dst.texels.resize(static_cast<size_t>(dst.width) * dst.height);
+
+        for (int y = 0; y < dst.height; y++)
+        {
+            int y0 = std::min(2 * y, src.height - 1);
+            int y1 = std::min(2 * y + 1, src.height - 1);
+
+            for (int x = 0; x < dst.width; x++)
+            {
+                int x0 = std::min(2 * x, src.width - 1);
+                int x1 = std::min(2 * x + 1, src.width - 1);
+
+                const auto &c00 = src.texels[y0 * src.width + x0];
+                const auto &c10 = src.texels[y0 * src.width + x1];
+                const auto &c01 = src.texels[y1 * src.width + x0];
+                const auto &c11 = src.texels[y1 * src.width + x1];
+
+                auto &c = dst.texels[y * dst.width + x];
+                for (int i = 0; i < 4; i++)
+                    c[i] = static_cast<uint8_t>(
+                        (c00[i] + c10[i] + c01[i] + c11[i] + 2) / 4);
+            }
+        }
+
+        levels.push_back(std::move(dst));
+    }
+
+    if (layout == Layout::linear)
+        return;
 
-    switch (channel_count)
+    // Reorder the levels into whole blocks. Texels in the padding of partial
+    // blocks are never read.
+    int block_size = layout == Layout::tiled ? 4 : 8;
+
+    for (auto &level : levels)
     {
-    case 3:
-        return Color8{pixel[0], pixel[1], pixel[2], 0};
-    case 4:
-        // TODO: reinterpret_cast or maybe return a reference?
-        return Color8{pixel[0], pixel[1], pixel[2], pixel[3]};
-    default:
-        abort();
+        int blocks_x = (level.width + block_size - 1) / block_size;
+        int blocks_y = (level.height + block_size - 1) / block_size;
+
+        vector<Color8> texels(static_cast<size_t>(blocks_x) * blocks_y *
+                              block_size * block_size);
+
+        for (int y = 0; y < level.height; y++)
+        {
+            for (int x = 0; x < level.width; x++)
+            {
+                auto i = layout == Layout::tiled
+                             ? texel_index<Layout::tiled>(blocks_x, x, y)
+                             : texel_index<Layout::morton>(blocks_x, x, y);
+                texels[i] = level.texels[y * level.width + x];
+            }
+        }
+
+        level.pitch = blocks_x;
+        level.texels = std::move(texels);
     }
 }
 
+Color8 Texture::operator()(float u, float v) const
+{
+    return (*this)(static_cast<int>(round(u * get_width() - 0.5)),
+                   static_cast<int>(round(v * get_height() - 0.5)));
+}
+
+Color8 Texture::operator()(Vec2 c) const { return (*this)(c.x, c.y); }
+
+Color8 Texture::operator()(int x, int y) const
+{
+    return dispatch(layout, mode,
+                    [&](auto l, auto m)
+                    { return texel<l(), m()>(levels[0], x, y); });
+}
+
 Color8 Texture::operator()(IVec2 c) const { return (*this)(c.x, c.y); }
 
-optional<Texture> Texture::from_file(const path &filename)
+template <Texture::Layout layout, Texture::WrapMode mode>
+Color8 Texture::texel(const MipLevel &level, int x, int y) const
+{
+    if constexpr (mode == WrapMode::repeat)
+    {
+        x %= level.width;
+        y %= level.height;
+        x += x < 0 ? level.width : 0;
+        y += y < 0 ? level.height : 0;
+    }
+    else
+    {
+        x = clamp(x, 0, level.width - 1);
+        y = clamp(y, 0, level.height - 1);
+    }
+
+    return level.texels[texel_index<layout>(level.pitch, x, y)];
+}
+
+template <Texture::Layout layout, Texture::WrapMode mode>
+Color Texture::bilinear(const MipLevel &level, Vec2 uv) const
+{
+    // Texel centers lie at half-integer coordinates.
+    float x = uv.x * level.width - 0.5f;
+    float y = uv.y * level.height - 0.5f;
+
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float tx = x - x0;
+    float ty = y - y0;
+
+    auto fetch = [&](int dx, int dy)
+    {
+        auto c = texel<layout, mode>(level, static_cast<int>(x0) + dx,
+                                     static_cast<int>(y0) + dy);
+        return Color{static_cast<float>(c.r), static_cast<float>(c.g),
+                     static_cast<float>(c.b), static_cast<float>(c.a)};
+    };
+
+    return lerp(lerp(fetch(0, 0), fetch(1, 0), tx),
+                lerp(fetch(0, 1), fetch(1, 1), tx), ty);
+}
+
+float Texture::lod(Vec2 uv_dx, Vec2 uv_dy) const
+{
+    Vec2 size{static_cast<float>(get_width()),
+              static_cast<float>(get_height())};
+
+    float rho = std::max(dot(uv_dx * size, uv_dx * size),
+                         dot(uv_dy * size, uv_dy * size));
+
+    // log2(sqrt(rho)), without the square root.
+    return 0.5f * std::log2(rho);
+}
+
+Color8 Texture::sample(Vec2 uv, float lod) const
+{
+    return dispatch(layout, mode,
+                    [&](auto l, auto m) { return sample<l(), m()>(uv, lod); });
+}
+
+template <Texture::Layout layout, Texture::WrapMode mode>
+Color8 Texture::sample(Vec2 uv, float lod) const
+{
+    auto to_color8 = [](Color c)
+    {
+        return Color8{static_cast<uint8_t>(c.r + 0.5f),
+                      static_cast<uint8_t>(c.g + 0.5f),
+                      static_cast<uint8_t>(c.b + 0.5f),
+                      static_cast<uint8_t>(c.a + 0.5f)};
+    };
+
+    // Magnification and degenerate derivatives use the base level.
+    float max_lod = static_cast<float>(levels.size() - 1);
+    lod = std::isnan(lod) ? 0.f : std::clamp(lod, 0.f, max_lod);
+
+    switch (filter)
+    {
+    case Filter::nearest:
+        return texel<layout, mode>(
+            levels[0], static_cast<int>(round(uv.x * get_width() - 0.5)),
+            static_cast<int>(round(uv.y * get_height() - 0.5)));
+    case Filter::bilinear:
+        return to_color8(bilinear<layout, mode>(
+            levels[static_cast<size_t>(lod + 0.5f)], uv));
+    case Filter::trilinear:
+        break;
+    }
+
+    auto level = static_cast<size_t>(lod);
+    float t = lod - level;
+
+    auto c = bilinear<layout, mode>(levels[level], uv);
+    if (t > 0.f)
+        c = lerp(c, bilinear<layout, mode>(levels[level + 1], uv), t);
+
+    return to_color8(c);
+}
+
+optional<Texture> Texture::from_file(const path &filename, Layout layout)
 {
     int width, height, chan_count;
 
-    auto *data = reinterpret_cast<uint8_t *>(
-        stbi_load(filename.c_str(), &width, &height, &chan_count, 0));
+    // Let stb convert to RGBA8, whatever the channel count of the file.
+    auto *data = stbi_load(filename.c_str(), &width, &height, &chan_count, 4);
+
+    if (data == nullptr)
+        return std::nullopt;
 
-    return data == nullptr
-               ? std::nullopt
-               : std::optional(Texture{width, height, chan_count,
-                                       std::unique_ptr<uint8_t>{data}});
+    Texture texture{width, height, reinterpret_cast<const Color8 *>(data),
+                    layout};
+    stbi_image_free(data);
+
+    return texture;
 }
 
-Model Model::from_obj(const std::filesystem::path &path)
+// Position, uv and normal indices of an OBJ face vertex. Face vertices with
+// identical triplets are merged into a single mesh vertex.
+struct IndexTriplet
 {
-    std::ifstream fs(path);
-    if (!fs.is_open())
-        throw std::runtime_error{"Error while opening file: " + path.string()};
+    int position;
+    int uv;
+    int normal;
 
-    string line;
+    bool operator==(const IndexTriplet &) const = default;
+};
 
+struct IndexTripletHash
+{
+    size_t operator()(const IndexTriplet &t) const
+    {
+        size_t h = std::hash<int>{}(t.position);
+        h = h * 31 + std::hash<int>{}(t.uv);
+        return h * 31 + std::hash<int>{}(t.normal);
+    }
+};
+
+// Face vertex as parsed from a chunk of an OBJ file. Negative OBJ indices
+// refer to elements before the face, and are stored relative to the start of
+// the chunk until the element counts of the preceding chunks are known.
+struct ObjCorner
+{
+    IndexTriplet index;
+    // Bit 0, 1 and 2 are set for relative position, uv and normal indices.
+    std::uint8_t relative;
+};
+
+// Elements parsed from a range of complete lines of an OBJ file.
+struct ObjChunk
+{
     vector<Vec3> positions;
     vector<Vec3> normals;
     vector<Vec2> uvs;
 
-    vector<Vertex> vertices;
+    // Faces fan-triangulated, so that every three corners form a triangle.
+    vector<ObjCorner> corners;
 
-    while (std::getline(fs, line))
+    // Line that failed to parse, empty on success.
+    string error;
+};
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static void skip_space(const char *&p, const char *end)
+{
+    while (p != end && is_space(*p))
+        p++;
+}
+
+template <typename T>
+static bool parse_number(const char *&p, const char *end, T &value)
+{
+    skip_space(p, end);
+
+    // from_chars doesn't accept an explicit plus sign.
+    if (p != end && *p == '+')
+        p++;
+
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc{})
+        return false;
+
+    p = next;
+    return true;
+}
+
+// Parses a one-based or negative OBJ index into a zero-based index, which is
+// relative to the start of the chunk for negative indices.
+static bool parse_index(const char *&p, const char *end, size_t count,
+                        int &index, bool &relative)
+{
+    int i;
+    if (!parse_number(p, end, i) || i == 0)
+        return false;
+
+    relative = i < 0;
+    index = relative ? static_cast<int>(count) + i : i - 1;
+    return true;
+}
+
+// Parses a face of three or more v, v/vt, v//vn or v/vt/vn corners.
+static bool parse_face(const char *p, const char *end, ObjChunk &chunk,
+                       vector<ObjCorner> &face)
+{
+    face.clear();
+
+    while (true)
     {
-        istringstream ss{line};
+        skip_space(p, end);
+        if (p == end || *p == '#')
+            break;
 
-        string type;
-        ss >> type;
+        ObjCorner c{IndexTriplet{-1, -1, -1}, 0};
+        bool relative;
 
-        if (type == "v")
-        {
-            float x, y, z;
-            ss >> x >> y >> z;
-            positions.emplace_back(x, y, z);
-        }
-        else if (type == "vt")
-        {
-            float u, v;
-            ss >> u >> v;
-            uvs.emplace_back(u, v);
-        }
-        else if (type == "vn")
-        {
-            float x, y, z;
-            ss >> x >> y >> z;
-            normals.emplace_back(x, y, z);
-        }
-        else if (type == "f")
-        {
-            string ln;
-            getline(ss, ln);
+        if (!parse_index(p, end, chunk.positions.size(), c.index.position,
+                         relative))
+            return false;
+        c.relative |= relative;
 
-            std::array<int, 3> v, uv, n;
+        if (p != end && *p == '/')
+        {
+            p++;
 
-            if (sscanf(ln.c_str(), "%d/%d/%d %d/%d/%d %d/%d/%d\n", &v[0],
-                       &uv[0], &n[0], &v[1], &uv[1], &n[1], &v[2], &uv[2],
-                       &n[2]) == 9)
-            {
-                // OBJ uses zero based-indexing.
-                for (auto i = 0; i < 3; i++)
-                    vertices.push_back(Vertex{positions[--v[i]],
-                                              normals[--n[i]], uvs[--uv[i]]});
-            }
-            else if (sscanf(ln.c_str(), "%d %d %d", &v[0], &v[1], &v[2]) == 3)
+            if (p != end && *p != '/')
             {
-                for (auto i = 0; i < 3; i++)
-                    vertices.push_back(
-                        Vertex{positions[--v[i]], Vec3{0}, Vec2{0}});
+                if (!parse_index(p, end, chunk.uvs.size(), c.index.uv,
+                                 relative))
+                    return false;
+                c.relative |= relative << 1;
             }
-            else
+
+            if (p != end && *p == '/')
             {
-                throw std::runtime_error{"Error while parsing line: " + line};
+                p++;
+
+                if (!parse_index(p, end, chunk.normals.size(), c.index.normal,
+                                 relative))
+                    return false;
+                c.relative |= relative << 2;
             }
         }
 
-        if (ss.bad())
-            throw std::runtime_error{"Error while parsing line: " + line};
+        if (p != end && !is_space(*p))
+            return false;
+
+        face.push_back(c);
+    }
+
+    if (face.size() < 3)
+        return false;
+
+    for (size_t i = 1; i + 1 < face.size(); i++)
+        chunk.corners.insert(chunk.corners.end(),
+                             {face[0], face[i], face[i + 1]});
+
+    return true;
+}
+
+static bool parse_line(const char *p, const char *end, ObjChunk &chunk,
+                       vector<ObjCorner> &face)
+{
+    skip_space(p, end);
+
+    const char *type_end = p;
+    while (type_end != end && !is_space(*type_end))
+        type_end++;
+
+    string_view type{p, static_cast<size_t>(type_end - p)};
+    p = type_end;
+
+    if (type == "v")
+    {
+        float x, y, z;
+        if (!parse_number(p, end, x) || !parse_number(p, end, y) ||
+            !parse_number(p, end, z))
+            return false;
+        chunk.positions.emplace_back(x, y, z);
+    }
+    else if (type == "vt")
+    {
+        // The second texture coordinate is optional.
+        float u, v = 0.f;
+        if (!parse_number(p, end, u))
+            return false;
+        parse_number(p, end, v);
+        chunk.uvs.emplace_back(u, v);
     }
+    else if (type == "vn")
+    {
+        float x, y, z;
+        if (!parse_number(p, end, x) || !parse_number(p, end, y) ||
+            !parse_number(p, end, z))
+            return false;
+        chunk.normals.emplace_back(x, y, z);
+    }
+    else if (type == "f")
+        return parse_face(p, end, chunk, face);
 
-    if (fs.bad())
-        throw std::runtime_error{"Error while reading file: " + path.string()};
+    // Other statements, like groups, materials and comments, are ignored.
+    return true;
+}
+
+static ObjChunk parse_chunk(string_view text)
+{
+    ObjChunk chunk;
+    vector<ObjCorner> face;
+
+    const char *p = text.data();
+    const char *end = p + text.size();
+
+    while (p != end)
+    {
+        const char *line_end = std::find(p, end, '\n');
+
+        if (!parse_line(p, line_end, chunk, face))
+        {
+            chunk.error = string{p, line_end};
+            break;
+        }
+
+        p = line_end == end ? end : line_end + 1;
+    }
+
+    return chunk;
+}
+
+Model Model::from_obj(const std::filesystem::path &path, ThreadPool &pool)
+{
+    // The text is parsed front to back once.
+    MappedFile file{path, MappedFile::Access::sequential};
+    auto text = file.view();
+
+    // Split the file into chunks of complete lines, a few per thread so that
+    // uneven chunks still balance.
+    const size_t target_size = std::max<size_t>(
+        text.size() / (4 * pool.size()), size_t{1} << 20);
+
+    vector<size_t> bounds{0};
+    while (bounds.back() < text.size())
+    {
+        auto next = text.find('\n', bounds.back() + target_size);
+        bounds.push_back(next == string_view::npos ? text.size() : next + 1);
+    }
+
+    vector<ObjChunk> chunks(bounds.size() - 1);
+
+    pool.parallel_for(chunks.size(),
+                      [&](size_t i, size_t)
+                      {
+                          chunks[i] = parse_chunk(text.substr(
+                              bounds[i], bounds[i + 1] - bounds[i]));
+                      });
+
+    vector<Vec3> positions;
+    vector<Vec3> normals;
+    vector<Vec2> uvs;
+
+    for (auto &chunk : chunks)
+    {
+        if (!chunk.error.empty())
+            throw std::runtime_error{"Error while parsing line: " +
+                                     chunk.error};
+
+        // Resolve relative indices now that the preceding element counts
+        // are known.
+        for (auto &c : chunk.corners)
+        {
+            if (c.relative & 1)
+                c.index.position += positions.size();
+            if (c.relative & 2)
+                c.index.uv += uvs.size();
+            if (c.relative & 4)
+                c.index.normal += normals.size();
+        }
+
+        positions.insert(positions.end(), chunk.positions.begin(),
+                         chunk.positions.end());
+        normals.insert(normals.end(), chunk.normals.begin(),
+                       chunk.normals.end());
+        uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+
+        chunk.positions = {};
+        chunk.normals = {};
+        chunk.uvs = {};
+    }
+
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+    std::unordered_map<IndexTriplet, uint32_t, IndexTripletHash> lookup;
+
+    vertices.reserve(positions.size());
+    lookup.reserve(positions.size());
+
+    auto in_range = [](int i, size_t count)
+    { return i >= 0 && static_cast<size_t>(i) < count; };
+
+    // Appends the index of the vertex for the given zero-based triplet,
+    // adding the vertex if it wasn't seen before. Missing attributes are -1.
+    auto add_vertex = [&](IndexTriplet t)
+    {
+        if (!in_range(t.position, positions.size()) ||
+            (t.uv != -1 && !in_range(t.uv, uvs.size())) ||
+            (t.normal != -1 && !in_range(t.normal, normals.size())))
+            throw std::runtime_error{"Face index out of range in file: " +
+                                     path.string()};
+
+        auto [it, inserted] =
+            lookup.try_emplace(t, static_cast<uint32_t>(vertices.size()));
+
+        if (inserted)
+            vertices.push_back(
+                Vertex{positions[t.position],
+                       t.normal < 0 ? Vec3{0} : normals[t.normal],
+                       t.uv < 0 ? Vec2{0} : uvs[t.uv]});
+
+        indices.push_back(it->second);
+    };
+
+    for (const auto &chunk : chunks)
+        for (const auto &c : chunk.corners)
+            add_vertex(c.index);
 
     Model model{};
-    model.mesh = std::make_unique<Mesh>(Mesh{vertices});
+    model.mesh =
+        std::make_unique<Mesh>(std::move(vertices), std::move(indices));
+    return model;
+}
+
+Model Model::from_obj_cached(const std::filesystem::path &path,
+                             ThreadPool &pool)
+{
+    auto cache_path = path;
+    cache_path += ".mesh";
+
+    Model model{};
+    model.mesh = read_mesh_file(cache_path, path);
+
+    if (model.mesh == nullptr)
+    {
+        model = from_obj(path, pool);
+
+        // Failing to write the cache, e.g. next to read-only assets, only
+        // costs the next startup.
+        try
+        {
+            write_mesh_file(cache_path, *model.mesh, path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Could not write mesh cache: " << e.what()
+                      << std::endl;
+        }
+    }
+
     return model;
 }
 
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
 #include <utility>
 #include <vector>
 
@@ -11,6 +14,8 @@
 namespace rasterizer
 {
 
+class ThreadPool;
+
 struct Vertex
 {
     Vec3 position;
@@ -18,23 +23,40 @@ struct Vertex
     Vec2 uv;
 };
 
+// Axis-aligned bounding box.
+struct Bounds
+{
+    Vec3 min;
+    Vec3 max;
+};
+
+// Indexed triangle mesh. Every three consecutive indices form a triangle.
+// Vertices and indices are immutable views into storage that the mesh keeps
+// alive, which is either owned or, for example, a memory mapped file.
 class Mesh
 {
   private:
+    std::shared_ptr<const void> storage;
+
   public:
-    std::vector<Vertex> vertices;
-    Mesh(std::vector<Vertex> vertices) : vertices{std::move(vertices)} {}
-};
+    std::span<const Vertex> vertices;
+    std::span<const std::uint32_t> indices;
+    Bounds bounds;
 
-class Texture
-{
+    // Takes ownership of the vertices and indices.
+    Mesh(std::vector<Vertex> vertices, std::vector<std::uint32_t> indices);
 
-    int width;
-    int height;
-    int channel_count;
+    // Refers to data kept alive by storage, without copying.
+    Mesh(std::span<const Vertex> vertices,
+         std::span<const std::uint32_t> indices, Bounds bounds,
+         std::shared_ptr<const void> storage);
 
-    std::unique_ptr<std::uint8_t> data;
+    std::size_t triangle_count() const { return indices.size() / 3; }
+};
 
+// RGBA8 texture with a full mip chain.
+class Texture
+{
   public:
     enum class WrapMode
     {
@@ -42,13 +64,82 @@ class Texture
         clamp,
     };
 
+    enum class Filter
+    {
+        // Nearest texel of the base level, ignoring the LOD.
+        nearest,
+        // Bilinear filtering within the mip level closest to the LOD.
+        bilinear,
+        // Bilinear filtering within the two mip levels around the LOD,
+        // blended linearly.
+        trilinear,
+    };
+
+    // Order of the texels in memory.
+    enum class Layout
+    {
+        // Row after row.
+        linear,
+        // 4x4 blocks of texels, one cache line each, stored row after row.
+        tiled,
+        // 8x8 blocks stored row after row, with texels in Morton order
+        // inside a block. Every aligned 4x4 quarter is one cache line.
+        morton,
+    };
+
     WrapMode mode = WrapMode::repeat;
+    Filter filter = Filter::nearest;
+
+  private:
+    struct MipLevel
+    {
+        int width;
+        int height;
+        // Number of blocks per row of blocks, or texels per row for the
+        // linear layout.
+        int pitch;
+        std::vector<Color8> texels;
+    };
 
-    Texture(int width, int height, int channel_count,
-            std::unique_ptr<std::uint8_t> data);
+    Layout layout;
 
-    static std::optional<Texture> from_file(const std::filesystem::path &path);
+    // Level 0 is the full resolution image, every next level halves both
+    // dimensions down to 1x1.
+    std::vector<MipLevel> levels;
 
+    // Lookups are specialized on the layout and wrap mode, which are picked
+    // once per sample rather than once per texel.
+    template <Layout layout, WrapMode mode>
+    Color8 texel(const MipLevel &level, int x, int y) const;
+    template <Layout layout, WrapMode mode>
+    Color bilinear(const MipLevel &level, Vec2 uv) const;
+    template <Layout layout, WrapMode mode>
+    Color8 sample(Vec2 uv, float lod) const;
+
+  public:
+    // Copies the RGBA8 pixels into the base level, generates the mip chain
+    // and stores all levels in the given layout.
+    Texture(int width, int height, const Color8 *pixels,
+            Layout layout = Layout::tiled);
+
+    static std::optional<Texture>
+    from_file(const std::filesystem::path &path,
+              Layout layout = Layout::tiled);
+
+    Layout get_layout() const { return layout; }
+
+    int get_width() const { return levels[0].width; }
+    int get_height() const { return levels[0].height; }
+    int get_level_count() const { return static_cast<int>(levels.size()); }
+
+    // Returns the LOD for the given screen-space derivatives of the texture
+    // coordinates, i.e. the log2 of the texel footprint of a pixel.
+    float lod(Vec2 uv_dx, Vec2 uv_dy) const;
+
+    // Samples the texture with the current filter at the given LOD.
+    Color8 sample(Vec2 uv, float lod) const;
+
+    // Nearest texel lookups into the base level.
     Color8 operator()(int x, int y) const;
     Color8 operator()(IVec2 c) const;
 
@@ -62,7 +153,13 @@ class Model
     std::unique_ptr<Mesh> mesh;
     std::unique_ptr<Texture> diffuse_texture;
 
-    static Model from_obj(const std::filesystem::path &path);
+    // Parses the file in chunks on the threads of the pool.
+    static Model from_obj(const std::filesystem::path &path, ThreadPool &pool);
+
+    // Like from_obj, but goes through a binary mesh cache next to the OBJ
+    // file, which is rebuilt when the OBJ file changes.
+    static Model from_obj_cached(const std::filesystem::path &path,
+                                 ThreadPool &pool);
 };
 
 } // namespace rasterizer
\ No newline at end of file
@@ -1,306 +1,839 @@
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
 
-#include <SDL2/SDL.h>
-#include <SDL_keycode.h>
-#include <SDL_messagebox.h>
-#include <SDL_mouse.h>
-#include <SDL_render.h>
-#include <SDL_timer.h>
-#include <SDL_video.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 #include "camera.hpp"
 #include "matrix.hpp"
 #include "model.hpp"
 #include "rasterizer.hpp"
-#include "utils.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
 #include "vector.hpp"
 
-using std::round;
-
 using namespace rasterizer;
-using namespace utils;
 
-static IVec2 get_mouse_position()
+// Returns the key of the cleared depth buffer in the given format.
+static float depth_key_max(DepthFormat format)
 {
-    int x, y;
-    SDL_GetMouseState(&x, &y);
-    return IVec2{x, y};
+    switch (format)
+    {
+    case DepthFormat::unorm24:
+        return static_cast<float>(depth_clear<uint32_t>);
+    case DepthFormat::unorm16:
+        return static_cast<float>(depth_clear<uint16_t>);
+    default:
+        return depth_clear<float>;
+    }
 }
 
-Rasterizer::Rasterizer(int width, int height, Model &&model)
-    : width{width}, height{height}, model{std::move(model)},
-      camera{Vec3{0.f, 2.f, 2.f}, Vec3{0.f}},
-      depth_buffer{static_cast<size_t>(width), static_cast<size_t>(height)},
-      color_buffer{static_cast<size_t>(width), static_cast<size_t>(height)},
-      shader(width, height)
+// Returns the scale and offset from depth in normalized device coordinates
+// to depth keys, see DepthBuffer.
+static Vec2 depth_key_mapping(DepthFormat format, bool reversed_z)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
-        throw std::runtime_error("Failed to initialize SDL.");
+    if (format == DepthFormat::float32)
+        return Vec2{reversed_z ? -1.f : 1.f, 0.f};
+
+    // Unorm keys grow from 0 at the near plane, where reversed-Z depth is 1
+    // and standard depth is -1.
+    float max = depth_key_max(format);
+    return reversed_z ? Vec2{-max, max} : Vec2{0.5f * max, 0.5f * max};
+}
 
-    SDL_CreateWindowAndRenderer(width, height, 0, &window, &renderer);
-    color_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                      SDL_TEXTUREACCESS_STATIC, width, height);
+static DepthBuffer make_depth_buffer(DepthFormat format, size_t width,
+                                     size_t height, FrameLayout layout)
+{
+    switch (format)
+    {
+    case DepthFormat::unorm24:
+        return FrameBuffer<uint32_t>{width, height, layout};
+    case DepthFormat::unorm16:
+        return FrameBuffer<uint16_t>{width, height, layout};
+    default:
+        return FrameBuffer<float>{width, height, layout};
+    }
 }
 
-Rasterizer::~Rasterizer()
+// Returns the guard band of a viewport, which viewports larger than it
+// replace.
+static ClipRegion whole_guard_band(int width, int height)
 {
-    SDL_DestroyWindow(window);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyTexture(color_texture);
+    Vec2 extent{std::max(1.f, guard_band_size / static_cast<float>(width)),
+                std::max(1.f, guard_band_size / static_cast<float>(height))};
 
-    SDL_Quit();
+    return ClipRegion{-extent, extent, IVec2{0, 0},
+                      IVec2{(width - 1) / tile_size, (height - 1) / tile_size}};
 }
 
-void Rasterizer::run()
+// Interval of a viewport dimension that belongs to a region, see
+// region_size.
+struct RegionSpan
 {
-    bool close_window = false;
+    int first_tile;
+    int last_tile;
+    // Center and half extent of its guard band in normalized device
+    // coordinates, with the axis pointing right or down.
+    float center;
+    float extent;
+};
+
+// Splits a viewport dimension of the given size into regions. Dimensions
+// that fit the guard band are a single region.
+static std::vector<RegionSpan> split_viewport(int size)
+{
+    auto fsize = static_cast<float>(size);
+    float extent = guard_band_size / fsize;
+
+    if (fsize <= guard_band_size)
+        return {RegionSpan{0, (size - 1) / tile_size, 0.f, extent}};
 
-    while (!close_window)
+    std::vector<RegionSpan> spans;
+    for (int start = 0; start < size; start += region_size)
     {
+        int end = std::min(start + region_size, size);
+        float center = static_cast<float>(start + end) / fsize - 1.f;
+        spans.push_back(RegionSpan{start / tile_size, (end - 1) / tile_size,
+                                   center, extent});
+    }
 
-        // Event polling
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
-        {
-            switch (event.type)
-            {
-            case SDL_QUIT:
-                close_window = true;
-                break;
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym)
-                {
-                case SDLK_f:
-                    if (presented_buffer == BufferType::color)
-                        presented_buffer = BufferType::depth;
-                    else
-                        presented_buffer = BufferType::color;
-
-                    break;
-                }
-                break;
-            case SDL_MOUSEWHEEL:
-                camera.zoom(event.wheel.y);
-                camera.update(Vec2{0});
-            }
-        }
+    return spans;
+}
+
+Rasterizer::Rasterizer(int width, int height, Scene &&scene,
+                       FrameLayout layout)
+    : width{width}, height{height},
+      tile_count_x{(width + tile_size - 1) / tile_size},
+      tile_count_y{(height + tile_size - 1) / tile_size},
+      scene{std::move(scene)},
+      depth_buffer{make_depth_buffer(DepthFormat::float32,
+                                     static_cast<size_t>(width),
+                                     static_cast<size_t>(height), layout)},
+      color_buffer{static_cast<size_t>(width), static_cast<size_t>(height),
+                   layout},
+      hiz_buffer{static_cast<size_t>((width + block_size - 1) / block_size),
+                 static_cast<size_t>((height + block_size - 1) / block_size)},
+      tile_states(tile_count_x * tile_count_y, TileState::stale),
+      back{make_depth_buffer(DepthFormat::float32, color_buffer.get_width(),
+                             color_buffer.get_height(), layout),
+           {color_buffer.get_width(), color_buffer.get_height(), layout},
+           {hiz_buffer.get_width(), hiz_buffer.get_height()},
+           tile_states},
+      depth_key{depth_key_mapping(DepthFormat::float32, false)},
+      guard_band{whole_guard_band(width, height)},
+      arena{pool.size()}, bins(pool.size() * tile_count_x * tile_count_y),
+      clipped(pool.size()),
+      clipped_first(pool.size() + 1)
+{
+    if (width > max_viewport_size || height > max_viewport_size)
+        throw std::runtime_error{"Viewport exceeds the maximum size of " +
+                                 std::to_string(max_viewport_size) +
+                                 " pixels."};
+
+    if (static_cast<float>(std::max(width, height)) > guard_band_size)
+    {
+        for (const auto &y : split_viewport(height))
+            for (const auto &x : split_viewport(width))
+                // The y axis points up in normalized device coordinates.
+                regions.push_back(ClipRegion{
+                    Vec2{x.center - x.extent, -y.center - y.extent},
+                    Vec2{x.center + x.extent, -y.center + y.extent},
+                    IVec2{x.first_tile, y.first_tile},
+                    IVec2{x.last_tile, y.last_tile}});
+    }
+}
+
+Rasterizer::Rasterizer(int width, int height, Model &&model,
+                       FrameLayout layout)
+    : Rasterizer{width, height, Scene{std::move(model)}, layout}
+{
+}
+
+// Marks the tiles drawn into as stale.
+static void clear_tiles(std::vector<TileState> &states)
+{
+    for (auto &state : states)
+        if (state == TileState::drawn)
+            state = TileState::stale;
+}
+
+void Rasterizer::clear() { clear_tiles(tile_states); }
+
+void Rasterizer::swap_buffers()
+{
+    std::swap(color_buffer, back.color);
+    std::swap(depth_buffer, back.depth);
+    std::swap(hiz_buffer, back.hiz);
+    std::swap(tile_states, back.tile_states);
+}
+
+void Rasterizer::clear_back_buffers() { clear_tiles(back.tile_states); }
+
+void Rasterizer::invalidate_buffers()
+{
+    std::fill(tile_states.begin(), tile_states.end(), TileState::stale);
+    std::fill(back.tile_states.begin(), back.tile_states.end(),
+              TileState::stale);
+}
+
+void Rasterizer::set_depth_format(DepthFormat format)
+{
+    auto layout = color_buffer.get_layout();
+
+    depth_buffer = make_depth_buffer(format, width, height, layout);
+    back.depth = make_depth_buffer(format, width, height, layout);
+    depth_key = depth_key_mapping(format, reversed_z);
 
-        draw();
+    invalidate_buffers();
+}
+
+void Rasterizer::set_reversed_z(bool enabled)
+{
+    reversed_z = enabled;
+    depth_key = depth_key_mapping(get_depth_format(), reversed_z);
+
+    invalidate_buffers();
+}
 
-        SDL_UpdateTexture(color_texture, nullptr, color_buffer.get(),
-                          width * 4 * sizeof(uint8_t));
+FrameBuffer<Color8> &Rasterizer::get_color_buffer()
+{
+    resolve(tile_states, color_buffer, depth_buffer, hiz_buffer);
+    return color_buffer;
+}
+
+DepthBuffer &Rasterizer::get_depth_buffer()
+{
+    resolve(tile_states, color_buffer, depth_buffer, hiz_buffer);
+    return depth_buffer;
+}
 
-        set_color(clear_color);
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, color_texture, nullptr, nullptr);
-        SDL_RenderPresent(renderer);
+FrameBuffer<Color8> &Rasterizer::get_back_color_buffer()
+{
+    resolve(back.tile_states, back.color, back.depth, back.hiz);
+    return back.color;
+}
 
-        color_buffer.fill(0.f);
-        depth_buffer.fill(std::numeric_limits<float>::max());
+DepthBuffer &Rasterizer::get_back_depth_buffer()
+{
+    resolve(back.tile_states, back.color, back.depth, back.hiz);
+    return back.depth;
+}
 
-        // Show FPS.
-        int tick = SDL_GetTicks();
-        int fps = 1000.f / (tick - prev_tick);
-        prev_tick = tick;
+void Rasterizer::fill_tile(int tile, FrameBuffer<Color8> &color,
+                           DepthBuffer &depth, FrameBuffer<float> &hiz)
+{
+    constexpr float far = std::numeric_limits<float>::max();
+
+    int x = tile % tile_count_x * tile_size;
+    int y = tile / tile_count_x * tile_size;
+    int tile_width = std::min(tile_size, width - x);
+    int tile_height = std::min(tile_size, height - y);
+
+    color.fill(Color8{0}, x, y, tile_width, tile_height);
+    std::visit([&]<typename D>(FrameBuffer<D> &buffer)
+               { buffer.fill(depth_clear<D>, x, y, tile_width, tile_height); },
+               depth);
+    hiz.fill(far, x / block_size, y / block_size,
+             (tile_width + block_size - 1) / block_size,
+             (tile_height + block_size - 1) / block_size);
+}
 
-        // Clear and return to beginning of line.
-        std::cout << "\33[2K\r" << fps << std::flush;
+void Rasterizer::resolve(std::vector<TileState> &states,
+                         FrameBuffer<Color8> &color, DepthBuffer &depth,
+                         FrameBuffer<float> &hiz)
+{
+    for (size_t tile = 0; tile < states.size(); tile++)
+    {
+        if (states[tile] == TileState::stale)
+        {
+            fill_tile(static_cast<int>(tile), color, depth, hiz);
+            states[tile] = TileState::clean;
+        }
     }
 }
 
-int middle_mouse_down()
+void Rasterizer::set_shading_mode(ShadingMode mode)
 {
-    return SDL_GetMouseState(nullptr, nullptr) & SDL_BUTTON_MIDDLE;
+    shading_mode = mode;
+
+    if (mode == ShadingMode::deferred && !visibility_buffer)
+        visibility_buffer = std::make_unique<FrameBuffer<Visibility>>(
+            static_cast<size_t>(width), static_cast<size_t>(height),
+            color_buffer.get_layout());
+}
+
+void Rasterizer::draw(const Camera &camera)
+{
+    TextureShader shader;
+    auto models = scene.get_models();
+    if (!models.empty())
+        shader.uniforms.texture = models[0].model.diffuse_texture.get();
+
+    draw(camera, shader);
 }
 
-void Rasterizer::draw()
+void Positions::resize(std::size_t count)
 {
-    shader.uniforms.mvp =
-        perspective(utils::radians(90.f), (float)width / (float)height, 0.1f,
-                    100.f) *
-        camera.get_view();
-    shader.uniforms.texture = model.diffuse_texture.get();
+    count = (count + vertex_batch_size - 1) / vertex_batch_size *
+            vertex_batch_size;
 
-    auto new_mouse_position = get_mouse_position();
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    w.resize(count);
+}
+
+void Rasterizer::cull(const Mat4 &view_projection)
+{
+    const Frustum frustum{view_projection, reversed_z, far_clipping};
+    const auto models = scene.get_models();
 
-    if (middle_mouse_down())
-        camera.update(new_mouse_position - mouse_position);
+    draws.clear();
+    mvps.clear();
+    frame_vertex_count = 0;
+    frame_triangle_count = 0;
 
-    mouse_position = new_mouse_position;
+    stats.triangles = 0;
+    stats.culled = 0;
 
-    for (size_t i = 0; i < model.mesh->vertices.size(); i += 3)
+    for (const auto &instance : scene.get_instances())
     {
-        auto &v0 = model.mesh->vertices[i];
-        auto &v1 = model.mesh->vertices[i + 1];
-        auto &v2 = model.mesh->vertices[i + 2];
+        const auto &entry = models[instance.model];
+        const size_t triangle_count = entry.model.mesh->triangle_count();
 
-        auto out1 = shader.vertex(v0);
-        auto out2 = shader.vertex(v1);
-        auto out3 = shader.vertex(v2);
+        stats.triangles += triangle_count;
 
-        shader.post_process(out1);
-        shader.post_process(out2);
-        shader.post_process(out3);
+        if (!frustum.intersects(
+                rasterizer::transform(instance.transform, entry.bounds)))
+        {
+            stats.culled += triangle_count;
+            continue;
+        }
 
-        draw_triangle(out1, out2, out3);
+        const auto mvp_index = static_cast<uint32_t>(mvps.size());
+        mvps.push_back(view_projection * instance.transform);
+
+        for (size_t m = 0; m < entry.meshlets.meshlets.size(); m++)
+        {
+            const auto &meshlet = entry.meshlets.meshlets[m];
+
+            if (!frustum.intersects(
+                    rasterizer::transform(instance.transform, meshlet.bounds)))
+            {
+                stats.culled += meshlet.triangle_count;
+                continue;
+            }
+
+            draws.push_back(
+                MeshletDraw{static_cast<uint32_t>(instance.model),
+                            static_cast<uint32_t>(m), mvp_index,
+                            static_cast<uint32_t>(frame_vertex_count),
+                            static_cast<uint32_t>(frame_triangle_count)});
+
+            // Pad, so that batches of vertices never straddle two meshlets.
+            frame_vertex_count +=
+                (meshlet.vertex_count + vertex_batch_size - 1) /
+                vertex_batch_size * vertex_batch_size;
+            frame_triangle_count += meshlet.triangle_count;
+        }
     }
 }
 
-void Rasterizer::draw_point(Vec2 p, Color c)
+void Rasterizer::transform(const Mat4 &mvp, std::span<const Vertex> vertices,
+                           size_t out_first)
 {
-    draw_point(p, Color8{c.r * 255, c.g * 255, c.b * 255, c.a * 255});
+    auto &out = screen_positions;
+    auto &out_clip = clip_positions;
+
+    const size_t count = vertices.size();
+    const size_t batch_count =
+        (count + vertex_batch_size - 1) / vertex_batch_size;
+
+#ifdef __AVX__
+    static_assert(vertex_batch_size == 8, "Batches must fill AVX registers.");
+    static_assert(sizeof(Vertex) >= 4 * sizeof(float),
+                  "Positions are loaded together with the next float.");
+
+    __m256 m[4][4];
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            m[i][j] = _mm256_set1_ps(mvp[i][j]);
+
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 w = _mm256_set1_ps(static_cast<float>(width));
+    const __m256 h = _mm256_set1_ps(static_cast<float>(height));
+
+    for (size_t batch = 0; batch < batch_count; batch++)
+    {
+        auto j = batch * vertex_batch_size;
+        auto i = out_first + j;
+
+        // Gather the positions of eight vertices and transpose them into
+        // x, y and z rows. The fourth row holds whatever follows the position.
+        __m128 rows[8];
+        for (size_t k = 0; k < 8; k++)
+            rows[k] =
+                _mm_loadu_ps(&vertices[std::min(j + k, count - 1)].position.x);
+
+        _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+        _MM_TRANSPOSE4_PS(rows[4], rows[5], rows[6], rows[7]);
+
+        const __m256 p[4]{_mm256_set_m128(rows[4], rows[0]),
+                          _mm256_set_m128(rows[5], rows[1]),
+                          _mm256_set_m128(rows[6], rows[2]), one};
+
+        // Model to clip space.
+        __m256 clip[4];
+        for (int r = 0; r < 4; r++)
+        {
+            clip[r] = _mm256_mul_ps(m[r][0], p[0]);
+            for (int c = 1; c < 4; c++)
+                clip[r] = _mm256_add_ps(clip[r], _mm256_mul_ps(m[r][c], p[c]));
+        }
+
+        _mm256_storeu_ps(&out_clip.x[i], clip[0]);
+        _mm256_storeu_ps(&out_clip.y[i], clip[1]);
+        _mm256_storeu_ps(&out_clip.z[i], clip[2]);
+        _mm256_storeu_ps(&out_clip.w[i], clip[3]);
+
+        // Perspective divide to NDC space, keeping the reciprocal of w.
+        __m256 rw = _mm256_div_ps(one, clip[3]);
+        __m256 x = _mm256_mul_ps(clip[0], rw);
+        __m256 y = _mm256_mul_ps(clip[1], rw);
+        __m256 z = _mm256_mul_ps(clip[2], rw);
+
+        // Viewport transform to screen space.
+        x = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(x, one), half), w);
+        y = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, y), half), h);
+
+        _mm256_storeu_ps(&out.x[i], x);
+        _mm256_storeu_ps(&out.y[i], y);
+        _mm256_storeu_ps(&out.z[i], z);
+        _mm256_storeu_ps(&out.w[i], rw);
+    }
+#else
+    for (size_t k = 0; k < batch_count * vertex_batch_size; k++)
+    {
+        auto i = out_first + k;
+        const auto &vertex = vertices[std::min(k, count - 1)];
+
+        // Model to clip space.
+        Vec4 p = mvp * Vec4{vertex.position, 1.f};
+
+        out_clip.x[i] = p.x;
+        out_clip.y[i] = p.y;
+        out_clip.z[i] = p.z;
+        out_clip.w[i] = p.w;
+
+        // Perspective divide to NDC space. Homogenize, but keep reciprocal of
+        // w.
+        p.w = 1 / p.w;
+        p.x *= p.w;
+        p.y *= p.w;
+        p.z *= p.w;
+
+        // Viewport transform to screen space.
+        out.x[i] = (p.x + 1.f) / 2.f * (float)width;
+        out.y[i] = (1.f - p.y) / 2.f * (float)height;
+        out.z[i] = p.z;
+        out.w[i] = p.w;
+    }
+#endif
 }
 
-void Rasterizer::draw_point(Vec2 p, Color8 c) { color_buffer(p.x, p.y) = c; }
+// Returns the index of the last pixel center at or before the fixed-point
+// coordinate. Pixel centers lie at i + 0.5.
+static int last_center(int fixed)
+{
+    static_assert(subpixel_steps == 16, "The shift divides by 16.");
+
+    // Shifts round towards negative infinity, unlike division.
+    return (fixed - subpixel_steps / 2) >> 4;
+}
 
-void Rasterizer::draw_point(IVec2 p)
+// Planes that clip space is clipped against, as bits of an outcode.
+enum ClipPlane : unsigned
 {
-    SDL_RenderDrawPoint(renderer, p.x, p.y);
+    near_plane = 1 << 0,
+    far_plane = 1 << 1,
+    left_plane = 1 << 2,
+    right_plane = 1 << 3,
+    bottom_plane = 1 << 4,
+    top_plane = 1 << 5,
+};
+
+constexpr unsigned clip_plane_count = 6;
+
+// Returns the signed distance of a clip-space position to a plane, which is
+// negative outside of it. The x and y planes lie on the guard band of the
+// region.
+static float plane_distance(unsigned plane, Vec4 p, const ClipRegion &region,
+                            bool reversed_z)
+{
+    switch (plane)
+    {
+    case near_plane:
+        return reversed_z ? p.w - p.z : p.w + p.z;
+    case far_plane:
+        return reversed_z ? p.z : p.w - p.z;
+    case left_plane:
+        return p.x - region.min.x * p.w;
+    case right_plane:
+        return region.max.x * p.w - p.x;
+    case bottom_plane:
+        return p.y - region.min.y * p.w;
+    default:
+        return region.max.y * p.w - p.y;
+    }
 }
 
-// Returns the signed area of the parallelogram spanned by edges p0p1 and p0p2.
-// Given the line p0p1, the edge function has the useful property that:
-//  - edge(p0, p1, p2) = 0 if p2 is on the line,
-//  - edge(p0, p1, p2) > 0 if p2 is above/right of the line,
-//  - edge(p0, p1, p2) < 0 if p2 is under/left of the line.
-int edge(IVec2 p0, IVec2 p1, IVec2 p2)
+// Returns the set of planes that a clip-space position lies outside of.
+static unsigned outcode(Vec4 p, const ClipRegion &region, bool far_clipping,
+                        bool reversed_z)
 {
-    return (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    unsigned code = 0;
+
+    for (unsigned k = 0; k < clip_plane_count; k++)
+    {
+        unsigned plane = 1u << k;
+        if ((plane != far_plane || far_clipping) &&
+            !(plane_distance(plane, p, region, reversed_z) >= 0.f))
+            code |= plane;
+    }
+
+    return code;
 }
 
-// void shade_fragment(Vec3 v0, Vec3
+// Returns whether the screen-space bounds of a triangle are small enough to
+// keep it inside the guard band in every tile it overlaps.
+static bool fits_guard_band(Vec4 p0, Vec4 p1, Vec4 p2)
+{
+    constexpr float max_extent = guard_band_size - tile_size;
+
+    return std::max({p0.x, p1.x, p2.x}) - std::min({p0.x, p1.x, p2.x}) <=
+               max_extent &&
+           std::max({p0.y, p1.y, p2.y}) - std::min({p0.y, p1.y, p2.y}) <=
+               max_extent;
+}
 
-// Parallel implementation of Pineda's triangle rasterization algorithm.
-// https://dl.acm.org/doi/pdf/10.1145/54852.378457
-// https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
-// https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
-// https://scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/
-// https://web.archive.org/web/20130816170418/http://devmaster.net/forums/topic/1145-advanced-rasterization/
-void Rasterizer::draw_triangle(Varying in1, Varying in2, Varying in3)
+size_t Rasterizer::bin_triangles(size_t first, size_t last,
+                                 Bin *thread_bins, size_t thread,
+                                 std::vector<ClippedTriangle> &thread_clipped,
+                                 size_t &clipped_count)
 {
-    int prec = 16;
-    float fprec = static_cast<float>(prec);
+    size_t rejected = 0;
 
-    // Use fixed-point screen coordinates for sub-pixel precision.
-    IVec2 p0{std::round(fprec * in1.position.x),
-             std::round(fprec * in1.position.y)};
-    IVec2 p1{std::round(fprec * in2.position.x),
-             std::round(fprec * in2.position.y)};
-    IVec2 p2{std::round(fprec * in3.position.x),
-             std::round(fprec * in3.position.y)};
+    for (size_t t = first; t < last; t++)
+    {
+        const auto *index = &frame_indices[3 * t];
 
-    IVec2 min{std::min({p0.x, p1.x, p2.x}), std::min({p0.y, p1.y, p2.y})};
-    min /= prec;
-    IVec2 max{std::max({p0.x, p1.x, p2.x}), std::max({p0.y, p1.y, p2.y})};
-    max /= prec;
+        unsigned outside_any = 0;
+        unsigned outside_all = ~0u;
 
-    // Clip triangle.
-    min.x = std::max(0, min.x);
-    min.y = std::max(0, min.y);
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned code = outcode(clip_positions[index[k]], guard_band,
+                                    far_clipping, reversed_z);
+            outside_any |= code;
+            outside_all &= code;
+        }
 
-    max.x = std::min(width, max.x);
-    max.y = std::min(height, max.y);
+        Vec4 p0 = screen_positions[index[0]];
+        Vec4 p1 = screen_positions[index[1]];
+        Vec4 p2 = screen_positions[index[2]];
+
+        bool binned;
+
+        // Triangles outside a single plane are invisible. Triangles inside
+        // all planes are binned as they are, which is by far the common case.
+        if (outside_all)
+            binned = false;
+        else if (!outside_any &&
+                 (regions.empty() || fits_guard_band(p0, p1, p2)))
+            binned = bin_triangle(t, p0, p1, p2, guard_band, thread_bins,
+                                  thread);
+        else
+        {
+            binned = regions.empty()
+                         ? clip_triangle(t, outside_any, guard_band,
+                                         thread_bins, thread, thread_clipped)
+                         : clip_to_regions(t, thread_bins, thread,
+                                           thread_clipped);
+            clipped_count++;
+        }
 
-    // Pixel centers are located at (0.5, 0.5).
-    IVec2 p{round(fprec * (min.x + 0.5f)), round(fprec * (min.y + 0.5f))};
+        rejected += !binned;
+    }
+
+    return rejected;
+}
+
+bool Rasterizer::bin_triangle(uint32_t id, Vec4 p0, Vec4 p1, Vec4 p2,
+                              const ClipRegion &region, Bin *thread_bins,
+                              size_t thread)
+{
+    float min_x = std::min({p0.x, p1.x, p2.x});
+    float min_y = std::min({p0.y, p1.y, p2.y});
+    float max_x = std::max({p0.x, p1.x, p2.x});
+    float max_y = std::max({p0.y, p1.y, p2.y});
+
+    // Written such that triangles with NaN coordinates are skipped too.
+    if (!(min_x < width && min_y < height && max_x >= 0.f && max_y >= 0.f))
+        return false;
+
+    // Cull by the sign of the area in the same fixed-point coordinates that
+    // draw_triangle uses, which also rejects degenerate triangles.
+    IVec2 f0 = snap(p0.x, p0.y);
+    IVec2 f1 = snap(p1.x, p1.y);
+    IVec2 f2 = snap(p2.x, p2.y);
+
+    int area = edge(f0, f1, f2);
+
+    if (area == 0 || (cull_mode == CullMode::back && area < 0) ||
+        (cull_mode == CullMode::front && area > 0))
+        return false;
+
+    // Reject small triangles whose bounds lie between pixel centers.
+    IVec2 fixed_min{std::min({f0.x, f1.x, f2.x}), std::min({f0.y, f1.y, f2.y})};
+    IVec2 fixed_max{std::max({f0.x, f1.x, f2.x}), std::max({f0.y, f1.y, f2.y})};
+
+    if (last_center(fixed_min.x + subpixel_steps - 1) >
+            last_center(fixed_max.x) ||
+        last_center(fixed_min.y + subpixel_steps - 1) >
+            last_center(fixed_max.y))
+        return false;
+
+    int tile_min_x =
+        std::max(region.first_tile.x,
+                 static_cast<int>(std::max(min_x, 0.f)) / tile_size);
+    int tile_min_y =
+        std::max(region.first_tile.y,
+                 static_cast<int>(std::max(min_y, 0.f)) / tile_size);
+    int tile_max_x =
+        std::min(region.last_tile.x,
+                 static_cast<int>(std::min(max_x, width - 1.f)) / tile_size);
+    int tile_max_y =
+        std::min(region.last_tile.y,
+                 static_cast<int>(std::min(max_y, height - 1.f)) / tile_size);
+
+    if (tile_min_x > tile_max_x || tile_min_y > tile_max_y)
+        return false;
+
+    for (int y = tile_min_y; y <= tile_max_y; y++)
+        for (int x = tile_min_x; x <= tile_max_x; x++)
+            thread_bins[x + y * tile_count_x].push_back(id, arena, thread);
+
+    return true;
+}
+
+// Sutherland-Hodgman clipping in homogeneous coordinates, where clipping
+// before the perspective divide keeps vertices behind the camera from
+// wrapping around.
+// https://fabiensanglard.net/polygon_codec/clippingdocument/Clipping.pdf
+bool Rasterizer::clip_triangle(uint32_t triangle, unsigned outcode,
+                               const ClipRegion &region, Bin *thread_bins,
+                               size_t thread,
+                               std::vector<ClippedTriangle> &thread_clipped)
+{
+    // Vertex of the clipped polygon. Vertices of the original triangle that
+    // survive clipping keep their index, so that their screen-space position
+    // is the one that neighbouring triangles use, which keeps shared edges
+    // watertight.
+    struct ClipVertex
+    {
+        Vec4 position;
+        Vec3 weights;
+        int original;
+    };
 
-    // Precompute triangle edges for incremental computation of edge function.
-    IVec3 bc_row{edge(p1, p2, p), edge(p2, p0, p), edge(p0, p1, p)};
-    IVec3 bc_dx{p2.y - p1.y, p0.y - p2.y, p1.y - p0.y};
-    IVec3 bc_dy{p2.x - p1.x, p0.x - p2.x, p1.x - p0.x};
-    bc_dx *= prec;
-    bc_dy *= prec;
+    // Every plane adds at most one vertex.
+    constexpr size_t max_vertices = 3 + clip_plane_count;
 
-    // 1 / (2 * area of triangle)
-    float area_reciprocal = 1.f / edge(p0, p1, p2);
+    const auto *index = &frame_indices[3 * triangle];
 
-    // Adhere to the top-left rule fill convention by adding bias values.
-    // In clockwise order, left edges must go up while top edges stay horizontal
-    // and go right.
-    bc_row += prec * IVec3{bc_dy.x > 0 || (bc_dy.x == 0 && bc_dx.x > 0),
-                           bc_dy.y > 0 || (bc_dy.y == 0 && bc_dx.y > 0),
-                           bc_dy.z > 0 || (bc_dy.z == 0 && bc_dx.z > 0)};
+    std::array<ClipVertex, max_vertices> polygon{
+        ClipVertex{clip_positions[index[0]], Vec3{1.f, 0.f, 0.f}, 0},
+        ClipVertex{clip_positions[index[1]], Vec3{0.f, 1.f, 0.f}, 1},
+        ClipVertex{clip_positions[index[2]], Vec3{0.f, 0.f, 1.f}, 2}};
+    size_t count = 3;
 
-    for (p.y = min.y; p.y <= max.y; p.y++)
+    std::array<ClipVertex, max_vertices> clipped_polygon;
+
+    for (unsigned k = 0; k < clip_plane_count && count >= 3; k++)
     {
-        auto bc = bc_row;
+        unsigned plane = 1u << k;
+        if (!(outcode & plane))
+            continue;
+
+        size_t clipped_count = 0;
 
-        for (p.x = min.x; p.x <= max.x; p.x++)
+        for (size_t i = 0; i < count; i++)
         {
-            // Draw pixel if p is inside triangle.
-            if (bc.x > 0 && bc.y > 0 && bc.z > 0)
+            const auto &a = polygon[i];
+            const auto &b = polygon[(i + 1) % count];
+
+            float da = plane_distance(plane, a.position, region, reversed_z);
+            float db = plane_distance(plane, b.position, region, reversed_z);
+
+            if (da >= 0.f)
+                clipped_polygon[clipped_count++] = a;
+
+            // Add the intersection with the plane if the edge crosses it. It is
+            // computed from the inside vertex, so that triangles sharing the
+            // edge agree on it.
+            if ((da >= 0.f) != (db >= 0.f))
             {
-                // Normalize the barycentric coordinates.
-                // TODO: Maybe we can do this using fixed-point arithmetic?
-                auto bc_n = static_cast<Vec3>(bc) * area_reciprocal;
-                float z = dot(
-                    bc_n, Vec3{in1.position.z, in2.position.z, in3.position.z});
-
-                if (z < depth_buffer(p.x, p.y))
-                {
-                    depth_buffer(p.x, p.y) = z;
-
-                    draw_point(
-                        p, shader.fragment(shader.vary(bc_n, in1, in2, in3)));
-
-                    if (presented_buffer == BufferType::depth)
-                        draw_point(p, Color{1 / z, 1 / z, 1 / z, 1.f});
-                }
+                const auto &in = da >= 0.f ? a : b;
+                const auto &out = da >= 0.f ? b : a;
+                float d = da >= 0.f ? da : db;
+                float s = d / (std::abs(da) + std::abs(db));
+
+                clipped_polygon[clipped_count++] = ClipVertex{
+                    in.position + s * (out.position - in.position),
+                    in.weights + s * (out.weights - in.weights), -1};
             }
-
-            bc -= bc_dx;
         }
 
-        bc_row += bc_dy;
+        polygon = clipped_polygon;
+        count = clipped_count;
     }
-}
 
-// Integer-only implementation of Bresenham's line algorithm.
-// https://www.cs.helsinki.fi/group/goa/mallinnus/lines/bresenh.html
-void Rasterizer::draw_line(IVec2 p1, IVec2 p2)
-{
-    if (!in_bounds(p1.x, 0, width) || !in_bounds(p2.x, 0, width) ||
-        !in_bounds(p1.y, 0, height) || !in_bounds(p1.y, 0, height))
-        return;
+    if (count < 3)
+        return false;
 
-    bool mirror = false;
-    if (std::abs(p1.x - p2.x) < std::abs(p1.y - p2.y))
+    // Perspective divide and viewport transform as in transform().
+    std::array<Vec4, max_vertices> screen;
+    for (size_t i = 0; i < count; i++)
     {
-        std::swap(p1.x, p1.y);
-        std::swap(p2.x, p2.y);
-        mirror = true;
+        const auto &v = polygon[i];
+
+        if (v.original >= 0)
+        {
+            screen[i] = screen_positions[index[v.original]];
+            continue;
+        }
+
+        Vec4 p = v.position;
+        p.w = 1 / p.w;
+        p.x *= p.w;
+        p.y *= p.w;
+        p.z *= p.w;
+
+        screen[i] = Vec4{(p.x + 1.f) / 2.f * (float)width,
+                         (1.f - p.y) / 2.f * (float)height, p.z, p.w};
     }
 
-    // Keep the invariant property that p1 lay left of p2.
-    if (p1.x > p2.x)
-        std::swap(p1, p2);
+    // The polygon is convex, so it is split into a triangle fan.
+    bool binned = false;
 
-    auto d = p2 - p1;
+    for (size_t i = 1; i + 1 < count; i++)
+    {
+        auto id = static_cast<uint32_t>(frame_triangle_count +
+                                        thread_clipped.size());
+
+        if (!bin_triangle(id, screen[0], screen[i], screen[i + 1], region,
+                          thread_bins, thread))
+            continue;
+
+        thread_clipped.push_back(ClippedTriangle{
+            triangle,
+            {screen[0], screen[i], screen[i + 1]},
+            {polygon[0].weights, polygon[i].weights, polygon[i + 1].weights}});
+        binned = true;
+    }
 
-    // ie = 2*e*dx, where e is the actual accumulated error so far.
-    // We keep track of this term since it's always an integer, unlike e.
-    int ie = 0;
+    return binned;
+}
+
+bool Rasterizer::clip_to_regions(uint32_t triangle, Bin *thread_bins,
+                                 size_t thread,
+                                 std::vector<ClippedTriangle> &thread_clipped)
+{
+    const auto *index = &frame_indices[3 * triangle];
+    bool binned = false;
 
-    // Move from left to right, drawing the point to the right or to the
-    // top/bottom right of the previous point based on the current error.
-    do
+    for (const auto &region : regions)
     {
-        draw_point((mirror) ? p1.swap() : p1);
+        unsigned outside_any = 0;
+        unsigned outside_all = ~0u;
 
-        ie += std::abs(d.y);
-        if (2 * ie >= d.x)
+        for (int k = 0; k < 3; k++)
         {
-            p1.y += (d.y >= 0) ? 1 : -1;
-            ie -= d.x;
+            unsigned code = outcode(clip_positions[index[k]], region,
+                                    far_clipping, reversed_z);
+            outside_any |= code;
+            outside_all &= code;
         }
-    } while (++p1.x <= p2.x);
+
+        if (outside_all)
+            continue;
+
+        // Regions own disjoint tiles, so a triangle that fits the guard band
+        // of several of them is still binned only once per tile.
+        if (!outside_any)
+            binned |= bin_triangle(triangle, screen_positions[index[0]],
+                                   screen_positions[index[1]],
+                                   screen_positions[index[2]], region,
+                                   thread_bins, thread);
+        else
+            binned |= clip_triangle(triangle, outside_any, region, thread_bins,
+                                    thread, thread_clipped);
+    }
+
+    return binned;
+}
+
+void Rasterizer::draw_point(Vec2 p, Color c)
+{
+    draw_point(p, to_color8(c));
 }
 
-void Rasterizer::set_color(Color color)
+void Rasterizer::draw_point(Vec2 p, Color8 c) { color_buffer(p.x, p.y) = c; }
+
+Color Rasterizer::depth_color(float key) const
 {
-    SDL_SetRenderDrawColor(renderer, round(color.r * 255), round(color.g * 255),
-                           round(color.b * 255), round(color.a * 255));
+    float v;
+
+    if (get_depth_format() != DepthFormat::float32)
+        v = 1.f - key / depth_key_max(get_depth_format());
+    else
+        v = reversed_z ? -key : 1 / key;
+
+    return Color{v, v, v, 1.f};
+}
+
+// Vectorized for whole blocks of float keys.
+float Rasterizer::farthest_depth(const FrameBuffer<float> &depth, IVec2 block)
+{
+#ifdef __AVX2__
+    if (block.x + block_size <= width && block.y + block_size <= height)
+    {
+        static_assert(block_size == 8, "Rows must fit an AVX register.");
+
+        const auto pixels = depth.block(block.x, block.y);
+        const float *keys = depth.get();
+
+        __m256 m = _mm256_loadu_ps(&keys[pixels(0, 0)]);
+        for (int y = 1; y < block_size; y++)
+            m = _mm256_max_ps(m, _mm256_loadu_ps(&keys[pixels(0, y)]));
+
+        __m128 h = _mm_max_ps(_mm256_castps256_ps128(m),
+                              _mm256_extractf128_ps(m, 1));
+        h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+        return _mm_cvtss_f32(h);
+    }
+#endif
+
+    return farthest_depth<float>(depth, block);
 }
@@ -1,15 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <any>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <span>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
-#include <SDL2/SDL.h>
-#include <SDL_timer.h>
-
+#include "arena.hpp"
 #include "camera.hpp"
 #include "frame_buffer.hpp"
+#include "matrix.hpp"
 #include "model.hpp"
+#include "scene.hpp"
 #include "shader.hpp"
+#include "thread_pool.hpp"
 #include "vector.hpp"
 
 namespace rasterizer
@@ -21,45 +32,474 @@ enum class BufferType
     depth,
 };
 
+enum class ShadingMode
+{
+    // Shade every fragment that passes the depth test as it is rasterized.
+    forward,
+    // Rasterize into a visibility buffer first and shade every covered pixel
+    // once afterwards, so shading cost does not grow with overdraw.
+    deferred,
+};
+
+// Which triangles to discard by orientation. Front faces are counterclockwise
+// as seen from the camera, as in OpenGL.
+enum class CullMode
+{
+    none,
+    back,
+    front,
+};
+
+// Storage of the depth buffer.
+enum class DepthFormat
+{
+    float32,
+    // Fixed-point depth in [0, 1], stored in 32-bit integers.
+    unorm24,
+    unorm16,
+};
+
+// Depth values are stored as keys that grow with the distance from the
+// camera in every format, so that the depth test and the hierarchical depth
+// buffer always keep the smaller key. Float keys are the depth in normalized
+// device coordinates, negated with reversed-Z. Unorm keys scale the depth in
+// [0, 1] to the integers up to depth_clear, and are compared as integers.
+// Alternatives are in the order of DepthFormat.
+using DepthBuffer = std::variant<FrameBuffer<float>, FrameBuffer<std::uint32_t>,
+                                 FrameBuffer<std::uint16_t>>;
+
+// Key of the cleared depth buffer, which is farther than any other.
+template <typename D>
+constexpr D depth_clear = std::numeric_limits<D>::max();
+template <>
+inline constexpr std::uint32_t depth_clear<std::uint32_t> = (1u << 24) - 1;
+
+// Converts a key to the type it is stored as. Unorm keys are rounded and
+// clamped, so that geometry beyond the far plane is not drawn.
+template <typename D> D store_depth(float key)
+{
+    if constexpr (std::is_same_v<D, float>)
+        return key;
+    else
+        return static_cast<D>(std::nearbyint(
+            std::clamp(key, 0.f, static_cast<float>(depth_clear<D>))));
+}
+
+// Per-pixel output of the visibility pass in deferred shading.
+struct Visibility
+{
+    static constexpr std::uint32_t no_triangle =
+        std::numeric_limits<std::uint32_t>::max();
+
+    std::uint32_t triangle = no_triangle;
+    // Edge function values at the pixel center without the fill rule bias,
+    // in the vertex order of the triangle's setup, see TriangleSetup.
+    IVec3 edges;
+};
+
+// Number of vertices that Rasterizer::transform processes at once.
+constexpr std::size_t vertex_batch_size = 8;
+
+// Vertex positions in structure-of-arrays layout. The arrays are padded to a
+// multiple of vertex_batch_size, so that batches never need a remainder loop.
+struct Positions
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> w;
+
+    // Resizes to hold at least the given number of positions.
+    void resize(std::size_t count);
+
+    Vec4 operator[](std::size_t i) const
+    {
+        return Vec4{x[i], y[i], z[i], w[i]};
+    }
+};
+
+// Output of the vertex stage for a single vertex. The w component of the
+// screen-space position holds the reciprocal of the clip-space w.
+template <typename V> struct ScreenVertex
+{
+    Vec4 position;
+    V varying;
+};
+
+// Part of a triangle that crossed the near or far plane or the guard band,
+// produced by clipping during binning. Its vertices are blends of the
+// original triangle's vertices, and the weights of those blends are kept so
+// that the varyings can be blended the same way once the shader is known.
+struct ClippedTriangle
+{
+    std::uint32_t triangle;
+    // Screen-space positions, as in ScreenVertex.
+    std::array<Vec4, 3> positions;
+    std::array<Vec3, 3> weights;
+};
+
+// Wall-clock time spent in the stages of the pipeline during a draw() call.
+// Fragment shading happens inside the raster stage.
+struct FrameStats
+{
+    using Duration = std::chrono::duration<double>;
+
+    // Triangles of all instances in the scene.
+    std::size_t triangles = 0;
+    // Triangles of instances and meshlets outside of the view frustum, which
+    // skip the vertex stage.
+    std::size_t culled = 0;
+    // Triangles discarded before rasterization: outside the screen, culled,
+    // degenerate or not covering any pixel center.
+    std::size_t rejected = 0;
+    // Triangles that had to be clipped, see guard_band_size.
+    std::size_t clipped = 0;
+    // Chunks that the frame arena allocated from the heap, which is zero once
+    // it has grown to fit the scene.
+    std::size_t allocations = 0;
+
+    Duration vertex{};
+    Duration setup{};
+    Duration raster{};
+};
+
+// Number of sub-pixel steps per pixel in the fixed-point screen coordinates
+// that triangles are set up with.
+constexpr int subpixel_steps = 16;
+
+// Returns the fixed-point coordinates of a screen-space position.
+inline IVec2 snap(float x, float y)
+{
+    return IVec2{static_cast<int>(std::round(subpixel_steps * x)),
+                 static_cast<int>(std::round(subpixel_steps * y))};
+}
+
+// Width and height in pixels of the guard band around the center of the
+// viewport. Triangles that cross the near plane, or the far plane if far
+// clipping is enabled, are clipped in clip space. Other triangles are only
+// clipped in x and y if they extend past the guard band, which keeps the
+// differences of their fixed-point coordinates below 2^15 = 2048 *
+// subpixel_steps. Products of two such differences, as in the edge functions,
+// then fit in 32 bits. Viewports larger than the guard band are split into
+// regions, see region_size.
+constexpr float guard_band_size = 2000.f;
+static_assert(guard_band_size * subpixel_steps <= 1 << 15,
+              "Edge functions must not overflow inside the guard band.");
+
+// Largest width and height in pixels of the viewport.
+constexpr int max_viewport_size = 16384;
+static_assert(max_viewport_size * subpixel_steps <= 1 << 24,
+              "Fixed-point coordinates must be exact in floats.");
+
+// Width and height in pixels of the screen tiles that triangles are binned
+// into. Every tile is rasterized by a single thread, which therefore owns its
+// pixels in all buffers.
+constexpr int tile_size = 64;
+
+// Width and height in pixels of the blocks that draw_triangle classifies as
+// outside, inside or partially covered by a triangle before rasterizing. The
+// hierarchical depth buffer stores one value per block.
+constexpr int block_size = 8;
+static_assert(tile_size % block_size == 0,
+              "Blocks must not straddle tile boundaries.");
+
+// Width and height in pixels of the regions that viewports larger than the
+// guard band are split into. Every region has a guard band of its own around
+// its center. Triangles that are larger than guard_band_size - tile_size in
+// screen space, and could therefore touch pixels outside of it, are clipped
+// against the guard band of every region they overlap and only binned into
+// the tiles of that region. The edges that this clipping adds then lie
+// outside of the pixels drawn.
+constexpr int region_size = 1024;
+static_assert(region_size % tile_size == 0,
+              "Regions must not straddle tile boundaries.");
+static_assert(region_size <= guard_band_size - 2 * tile_size,
+              "Regions must lie well inside their guard band.");
+
+// Part of the screen that triangles are clipped and binned within.
+struct ClipRegion
+{
+    // Bounds of its guard band in normalized device coordinates.
+    Vec2 min;
+    Vec2 max;
+    // Tiles that triangles in the region are binned into, inclusive.
+    IVec2 first_tile;
+    IVec2 last_tile;
+};
+static_assert(block_size == frame_block_size,
+              "Rows of blocks must be contiguous in tiled frame buffers.");
+
+// Relative margin by which hierarchical depth tests are made conservative.
+constexpr float hiz_epsilon = 1e-6f;
+
+// State of a screen tile in a set of frame buffers. Clearing only marks
+// tiles as stale, which costs O(tiles). Their pixels are filled with the
+// clear values once draw() touches them, or once the buffers are read.
+enum class TileState : std::uint8_t
+{
+    // Holds the clear values.
+    clean,
+    // Cleared, but still holds the pixels of an earlier frame.
+    stale,
+    // Drawn into since the last clear.
+    drawn,
+};
+
 class Rasterizer
 {
   private:
     int width;
     int height;
 
-    Model model;
-    Shader shader;
-    Color clear_color = Color{0, 0, 0, 255};
+    int tile_count_x;
+    int tile_count_y;
+
+    Scene scene;
 
-    FrameBuffer<float> depth_buffer;
+    DepthBuffer depth_buffer;
     FrameBuffer<Color8> color_buffer;
 
-    Camera camera;
-    IVec2 mouse_position;
+    // Farthest depth key stored in each block of the depth buffer, see
+    // block_size. Lets draw_triangle reject occluded blocks early.
+    FrameBuffer<float> hiz_buffer;
 
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-    SDL_Texture *color_texture;
-    SDL_Texture *depth_texture;
+    std::vector<TileState> tile_states;
 
-    uint prev_tick;
+    // Buffers of the previous frame, which is presented while the next one
+    // is drawn, see swap_buffers().
+    struct BackBuffers
+    {
+        DepthBuffer depth;
+        FrameBuffer<Color8> color;
+        FrameBuffer<float> hiz;
+        std::vector<TileState> tile_states;
+    } back;
+
+    // Only allocated while deferred shading is enabled. The shading pass
+    // resets every pixel it visits, so the buffer never needs clearing.
+    std::unique_ptr<FrameBuffer<Visibility>> visibility_buffer;
 
     BufferType presented_buffer{BufferType::color};
+    ShadingMode shading_mode{ShadingMode::forward};
+    CullMode cull_mode{CullMode::back};
+    bool far_clipping = false;
+    bool reversed_z = false;
+    bool shading = true;
+
+    // Scale and offset from the depth in normalized device coordinates to the
+    // depth key, see DepthBuffer.
+    Vec2 depth_key;
+
+    // Guard band of the whole viewport, see guard_band_size.
+    ClipRegion guard_band;
+    // Only used for viewports larger than the guard band, see region_size.
+    std::vector<ClipRegion> regions;
+
+    FrameStats stats;
+
+    ThreadPool pool;
+
+    // Scratch storage of the current frame, which draw() releases when it
+    // is done.
+    FrameArena arena;
+
+    // Meshlet of an instance that passed culling in the current frame. Its
+    // vertices and triangles are numbered from first_vertex and
+    // first_triangle in the buffers of the frame.
+    struct MeshletDraw
+    {
+        std::uint32_t model;
+        std::uint32_t meshlet;
+        // Index into mvps.
+        std::uint32_t instance;
+        std::uint32_t first_vertex;
+        std::uint32_t first_triangle;
+    };
+
+    std::vector<MeshletDraw> draws;
+    // Model-view-projection matrices of the visible instances.
+    std::vector<Mat4> mvps;
+    std::size_t frame_vertex_count = 0;
+    std::size_t frame_triangle_count = 0;
+
+    // Clip-space and screen-space positions of the vertices of the current
+    // frame, which binning reads.
+    Positions clip_positions;
+    Positions screen_positions;
+    // Three vertex indices per triangle of the current frame.
+    std::vector<std::uint32_t> frame_indices;
+
+    // Vertices of the current frame as seen by triangle setup and shading.
+    // Holds a std::vector<ScreenVertex<V>> for the varyings V of the last
+    // shader drawn with, which is reused as long as the shader type does not
+    // change.
+    std::any screen_vertices;
+
+    // Triangle indices binned by tile, allocated from the frame arena. Every
+    // binning thread owns a contiguous range of triangles and its own set of
+    // bins, so that triangles keep their submission order within a tile. Bins
+    // of thread t for tile i are found at bins[t * tile_count + i].
+    using Bin = ArenaList<std::uint32_t>;
+    std::vector<Bin> bins;
+
+    // Triangles produced by clipping, per binning thread. Bins refer to them
+    // by their index offset by the triangle count of the mesh. Across threads
+    // they are numbered in thread order, starting at clipped_first[t] for
+    // thread t, to give them unique ids in the visibility buffer. Unlike bins
+    // they need random access, so they keep their capacity across frames
+    // instead of living in the arena.
+    std::vector<std::vector<ClippedTriangle>> clipped;
+    std::vector<std::uint32_t> clipped_first;
+
+    // Collects the meshlets of the instances that intersect the view frustum
+    // into draws, and numbers their vertices and triangles.
+    void cull(const Mat4 &view_projection);
+    // Transforms the positions of the vertices from model space to clip space
+    // and screen space, in batches that read straight from the mesh. The
+    // results are stored from index out_first on, and the lanes of the last
+    // batch past the end repeat the last vertex.
+    void transform(const Mat4 &mvp, std::span<const Vertex> vertices,
+                   std::size_t out_first);
+    // Returns the number of rejected triangles. Triangles that need clipping
+    // are counted in clipped_count. Bins grow from the arena of the executing
+    // thread.
+    std::size_t bin_triangles(std::size_t first, std::size_t last,
+                              Bin *thread_bins, std::size_t thread,
+                              std::vector<ClippedTriangle> &thread_clipped,
+                              std::size_t &clipped_count);
+    // Bins a triangle given the screen-space positions of its vertices under
+    // the given id into the tiles of the region, unless it can't produce any
+    // pixels there. Returns whether it was binned.
+    bool bin_triangle(std::uint32_t id, Vec4 p0, Vec4 p1, Vec4 p2,
+                      const ClipRegion &region, Bin *thread_bins,
+                      std::size_t thread);
+    // Clips a triangle against the planes in the outcode, with the x and y
+    // planes on the guard band of the region, then bins the resulting
+    // triangles. Returns whether any of them was binned.
+    bool clip_triangle(std::uint32_t triangle, unsigned outcode,
+                       const ClipRegion &region, Bin *thread_bins,
+                       std::size_t thread,
+                       std::vector<ClippedTriangle> &thread_clipped);
+    // Clips and bins a triangle separately in every region it overlaps.
+    // Returns whether it was binned in any of them.
+    bool clip_to_regions(std::uint32_t triangle, Bin *thread_bins,
+                         std::size_t thread,
+                         std::vector<ClippedTriangle> &thread_clipped);
+    // Returns the vertices of the triangle with the given id, which is either
+    // a triangle of the frame or a clipped one.
+    template <typename V>
+    std::array<ScreenVertex<V>, 3>
+    triangle_vertices(std::span<const ScreenVertex<V>> vertices,
+                      std::uint32_t id) const;
+    template <ShaderProgram S>
+    void draw_tile(const S &shader,
+                   std::span<const ScreenVertex<typename S::Varying>> vertices,
+                   int tile);
+    template <ShaderProgram S>
+    void shade_tile(const S &shader,
+                    std::span<const ScreenVertex<typename S::Varying>> vertices,
+                    IVec2 tile_min, IVec2 tile_max);
+    // Returns the farthest depth key stored in the block with the given
+    // origin.
+    float farthest_depth(const FrameBuffer<float> &depth, IVec2 block);
+    template <typename D>
+    float farthest_depth(const FrameBuffer<D> &depth, IVec2 block);
+    // Returns the color that presents a depth key, brighter when nearer.
+    Color depth_color(float key) const;
+    // Fills the pixels of a tile with the clear values.
+    void fill_tile(int tile, FrameBuffer<Color8> &color, DepthBuffer &depth,
+                   FrameBuffer<float> &hiz);
+    // Fills all stale tiles, which makes them clean.
+    void resolve(std::vector<TileState> &states, FrameBuffer<Color8> &color,
+                 DepthBuffer &depth, FrameBuffer<float> &hiz);
+    // Marks all tiles of both sets of buffers stale, after their depth keys
+    // changed meaning.
+    void invalidate_buffers();
 
   public:
-    Rasterizer(int width, int height, Model &&model);
+    // The layout applies to the color, depth and visibility buffers. Readers
+    // of the tiled layout should go through FrameBuffer::copy_linear.
+    Rasterizer(int width, int height, Scene &&scene,
+               FrameLayout layout = FrameLayout::linear);
+    // Draws a scene with a single instance of the model.
+    Rasterizer(int width, int height, Model &&model,
+               FrameLayout layout = FrameLayout::linear);
     Rasterizer(const Rasterizer &r) = delete;
     Rasterizer &operator=(const Rasterizer &r) = delete;
-    ~Rasterizer();
 
-    void run();
-    void draw();
-    void draw_triangle(Varying in0, Varying in1, Varying in2);
-    void draw_line(IVec2 p1, IVec2 p2);
-    void draw_point(IVec2 p);
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    // Buffers are resolved before they are returned, i.e. cleared tiles that
+    // were not drawn into since are filled.
+    FrameBuffer<Color8> &get_color_buffer();
+    // Holds depth keys, see DepthBuffer.
+    DepthBuffer &get_depth_buffer();
+
+    FrameBuffer<Color8> &get_back_color_buffer();
+    DepthBuffer &get_back_depth_buffer();
+
+    BufferType get_presented_buffer() const { return presented_buffer; }
+    void set_presented_buffer(BufferType type) { presented_buffer = type; }
+
+    // Disabling shading turns draw() into a depth-only pass.
+    bool get_shading() const { return shading; }
+    void set_shading(bool enabled) { shading = enabled; }
+
+    ShadingMode get_shading_mode() const { return shading_mode; }
+    void set_shading_mode(ShadingMode mode);
+
+    CullMode get_cull_mode() const { return cull_mode; }
+    void set_cull_mode(CullMode mode) { cull_mode = mode; }
+
+    // Triangles are always clipped against the near plane. Without far
+    // clipping, geometry beyond the far plane is drawn as well.
+    bool get_far_clipping() const { return far_clipping; }
+    void set_far_clipping(bool enabled) { far_clipping = enabled; }
+
+    // Changing the depth format or reversed-Z clears all buffers.
+    DepthFormat get_depth_format() const
+    {
+        return static_cast<DepthFormat>(depth_buffer.index());
+    }
+    void set_depth_format(DepthFormat format);
+
+    // Reversed-Z projects the near plane to depth 1 and the far plane to 0,
+    // see perspective(). Floats are densest near 0, which then balances the
+    // precision lost to the perspective divide far away.
+    bool get_reversed_z() const { return reversed_z; }
+    void set_reversed_z(bool enabled);
+
+    const FrameStats &get_stats() const { return stats; }
+
+    // Resets the color and depth buffers for the next frame. Only marks the
+    // tiles as cleared, see TileState.
+    void clear();
+    // Exchanges the buffers that draw() renders into with the back buffers,
+    // without copying. The frame that was just drawn can then be presented
+    // from the back buffers and cleared with clear_back_buffers(), while the
+    // next frame is drawn on another thread.
+    void swap_buffers();
+    // Resets the back buffers. Safe to call during draw().
+    void clear_back_buffers();
+    // Renders the scene as seen from the camera into the frame buffers, using
+    // a TextureShader with the diffuse texture of the first model.
+    void draw(const Camera &camera);
+    // Renders the scene as seen from the camera with the given shader.
+    template <ShaderProgram S> void draw(const Camera &camera, const S &shader);
+    // Draws into the alternative of depth_buffer that is passed in.
+    template <ShaderProgram S, typename D>
+    void draw_triangle(const S &shader,
+                       const ScreenVertex<typename S::Varying> &in0,
+                       const ScreenVertex<typename S::Varying> &in1,
+                       const ScreenVertex<typename S::Varying> &in2,
+                       std::uint32_t id, IVec2 tile_min, IVec2 tile_max,
+                       FrameBuffer<D> &depth_buffer);
     void draw_point(Vec2 p, Color8 c);
     void draw_point(Vec2 p, Color c);
-    void set_color(Color color);
 };
 
-} // namespace rasterizer
\ No newline at end of file
+} // namespace rasterizer
+
+// Definitions of the member templates, which are instantiated per shader.
+#include "rasterizer_impl.hpp"
@@ -0,0 +1,1048 @@
+// Definitions of the Rasterizer member templates, which are instantiated for
+// every shader program. Only included by rasterizer.hpp.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "rasterizer.hpp"
+#include "utils.hpp"
+
+namespace rasterizer
+{
+
+template <ShaderProgram S>
+void Rasterizer::draw(const Camera &camera, const S &shader)
+{
+    using clock = std::chrono::steady_clock;
+    using Vertices = std::vector<ScreenVertex<typename S::Varying>>;
+
+    auto vertex_start = clock::now();
+    const size_t allocation_count = arena.get_allocation_count();
+
+    const Mat4 view_projection =
+        perspective(utils::radians(90.f), (float)width / (float)height, 0.1f,
+                    100.f, reversed_z) *
+        camera.get_view();
+
+    const size_t tile_count = tile_count_x * tile_count_y;
+    const size_t thread_count = pool.size();
+
+    cull(view_projection);
+
+    // The buffer is kept across frames unless the varyings change type.
+    auto *out = std::any_cast<Vertices>(&screen_vertices);
+    if (!out)
+        out = &screen_vertices.emplace<Vertices>();
+
+    clip_positions.resize(frame_vertex_count);
+    screen_positions.resize(frame_vertex_count);
+    out->resize(frame_vertex_count);
+    frame_indices.resize(3 * frame_triangle_count);
+
+    // Vertex stage: transform the vertex positions of every visible meshlet
+    // in SIMD batches, run the vertex shader, and translate the indices of
+    // its triangles to the frame. Threads take jobs of several meshlets.
+    constexpr size_t meshlets_per_job = 8;
+    const auto models = scene.get_models();
+
+    pool.parallel_for(
+        (draws.size() + meshlets_per_job - 1) / meshlets_per_job,
+        [&](size_t job, size_t)
+        {
+            for (size_t d = job * meshlets_per_job;
+                 d < std::min(draws.size(), (job + 1) * meshlets_per_job); d++)
+            {
+                const auto &draw = draws[d];
+                const auto &entry = models[draw.model];
+                const auto &meshlets = entry.meshlets;
+                const auto &meshlet = meshlets.meshlets[draw.meshlet];
+                const auto vertices =
+                    meshlets.vertices(*entry.model.mesh, meshlet);
+
+                transform(mvps[draw.instance], vertices, draw.first_vertex);
+
+                for (size_t i = 0; i < vertices.size(); i++)
+                {
+                    size_t j = draw.first_vertex + i;
+                    (*out)[j] = {screen_positions[j],
+                                 shader.vertex(vertices[i])};
+                }
+
+                for (size_t k = 0; k < 3 * meshlet.triangle_count; k++)
+                    frame_indices[3 * draw.first_triangle + k] =
+                        draw.first_vertex +
+                        meshlets.indices[3 * meshlet.first_triangle + k];
+            }
+        });
+
+    const size_t triangle_count = frame_triangle_count;
+
+    auto setup_start = clock::now();
+
+    // Binning stage: reject triangles that can't produce any pixels and sort
+    // the others into the tiles their bounds overlap.
+    for (auto &triangles : clipped)
+        triangles.clear();
+
+    std::atomic<size_t> rejected{0};
+    std::atomic<size_t> clipped_count{0};
+
+    pool.parallel_for(thread_count,
+                      [&](size_t chunk, size_t thread)
+                      {
+                          size_t chunk_clipped = 0;
+                          rejected += bin_triangles(
+                              chunk * triangle_count / thread_count,
+                              (chunk + 1) * triangle_count / thread_count,
+                              &bins[chunk * tile_count], thread,
+                              clipped[chunk], chunk_clipped);
+                          clipped_count += chunk_clipped;
+                      });
+
+    for (size_t t = 0; t < thread_count; t++)
+        clipped_first[t + 1] =
+            clipped_first[t] + static_cast<uint32_t>(clipped[t].size());
+
+    auto raster_start = clock::now();
+
+    // Raster stage: tiles are independent, so they need no synchronization.
+    pool.parallel_for(tile_count, [&](size_t tile, size_t)
+                      { draw_tile<S>(shader, *out, tile); });
+
+    auto raster_end = clock::now();
+
+    // Release the scratch storage of the frame.
+    for (auto &bin : bins)
+        bin.clear();
+    arena.reset();
+
+    stats.rejected = rejected;
+    stats.clipped = clipped_count;
+    stats.allocations = arena.get_allocation_count() - allocation_count;
+    stats.vertex = setup_start - vertex_start;
+    stats.setup = raster_start - setup_start;
+    stats.raster = raster_end - raster_start;
+}
+
+// Varyings divided by w, followed by 1 / w. Unlike the varyings themselves,
+// these are linear in screen space.
+template <typename V>
+using LinearAttributes = std::array<float, varying_count<V> + 1>;
+
+template <typename V>
+LinearAttributes<V> perspective_attributes(const ScreenVertex<V> &v)
+{
+    const auto varying = std::bit_cast<std::array<float, varying_count<V>>>(
+        v.varying);
+
+    // The position holds 1 / w already.
+    LinearAttributes<V> a;
+    for (std::size_t k = 0; k < varying.size(); k++)
+        a[k] = varying[k] * v.position.w;
+    a.back() = v.position.w;
+
+    return a;
+}
+
+// Arguments of ShaderProgram::fragment.
+template <typename V> struct FragmentInput
+{
+    V in;
+    V dx;
+    V dy;
+};
+
+// Recovers the perspective-correct varyings at a pixel, and their exact
+// screen-space derivatives, from the linear attributes and their derivatives
+// along x and y at that pixel.
+template <typename V>
+FragmentInput<V> perspective_divide(const LinearAttributes<V> &a,
+                                    const LinearAttributes<V> &a_dx,
+                                    const LinearAttributes<V> &a_dy)
+{
+    constexpr auto n = varying_count<V>;
+
+    // The derivative of v = a / w' with w' = 1 / w is (a_dx - v * w'_dx) / w'.
+    const float w = 1.f / a[n];
+
+    std::array<float, n> in, dx, dy;
+    for (std::size_t k = 0; k < n; k++)
+    {
+        in[k] = a[k] * w;
+        dx[k] = (a_dx[k] - in[k] * a_dx[n]) * w;
+        dy[k] = (a_dy[k] - in[k] * a_dy[n]) * w;
+    }
+
+    return {std::bit_cast<V>(in), std::bit_cast<V>(dx), std::bit_cast<V>(dy)};
+}
+
+// Attributes that are linear in screen space, set up once per triangle from
+// their values at the vertices. At a pixel with the unbiased edge function
+// values e of draw_triangle, they equal a0 + e.y * e1 + e.z * e2. Moving one
+// pixel right or down adds dx or dy respectively.
+template <std::size_t n> struct AttributePlanes
+{
+    using Values = std::array<float, n>;
+
+    Values a0, e1, e2, dx, dy;
+
+    AttributePlanes() = default;
+
+    AttributePlanes(const Values &a0, const Values &a1, const Values &a2,
+                    float area_reciprocal, IVec3 bc_dx, IVec3 bc_dy)
+        : a0{a0}
+    {
+        for (std::size_t k = 0; k < n; k++)
+        {
+            e1[k] = (a1[k] - a0[k]) * area_reciprocal;
+            e2[k] = (a2[k] - a0[k]) * area_reciprocal;
+
+            // Edge functions decrease to the right and increase downwards.
+            dx[k] = -(static_cast<float>(bc_dx.y) * e1[k] +
+                      static_cast<float>(bc_dx.z) * e2[k]);
+            dy[k] = static_cast<float>(bc_dy.y) * e1[k] +
+                    static_cast<float>(bc_dy.z) * e2[k];
+        }
+    }
+
+    Values at(IVec3 e) const
+    {
+        Values a;
+        for (std::size_t k = 0; k < n; k++)
+            a[k] = a0[k] + static_cast<float>(e.y) * e1[k] +
+                   static_cast<float>(e.z) * e2[k];
+
+        return a;
+    }
+};
+
+template <ShaderProgram S>
+void Rasterizer::draw_tile(
+    const S &shader,
+    std::span<const ScreenVertex<typename S::Varying>> vertices, int tile)
+{
+    const size_t tile_count = tile_count_x * tile_count_y;
+    const auto &indices = frame_indices;
+
+    IVec2 tile_min{tile % tile_count_x * tile_size,
+                   tile / tile_count_x * tile_size};
+    IVec2 tile_max{std::min(tile_min.x + tile_size, width) - 1,
+                   std::min(tile_min.y + tile_size, height) - 1};
+
+    const auto triangle_count = static_cast<uint32_t>(frame_triangle_count);
+
+    // Tiles without triangles are left alone, so that they can stay cleared.
+    // Otherwise the pixels are cleared before they are drawn into for the
+    // first time since clear().
+    bool empty = true;
+    for (size_t t = 0; t < pool.size(); t++)
+        empty &= bins[t * tile_count + tile].empty();
+
+    if (empty)
+        return;
+
+    if (tile_states[tile] == TileState::stale)
+        fill_tile(tile, color_buffer, depth_buffer, hiz_buffer);
+    tile_states[tile] = TileState::drawn;
+
+    // Visit the bins in thread order to draw triangles in submission order.
+    auto draw_bins = [&](auto &depth)
+    {
+        for (size_t t = 0; t < pool.size(); t++)
+        {
+            for (auto i : bins[t * tile_count + tile])
+            {
+                if (i < triangle_count)
+                {
+                    draw_triangle(shader, vertices[indices[3 * i]],
+                                  vertices[indices[3 * i + 1]],
+                                  vertices[indices[3 * i + 2]], i, tile_min,
+                                  tile_max, depth);
+                    continue;
+                }
+
+                // Give clipped triangles their unique id, see clipped_first.
+                auto id = i + clipped_first[t];
+                auto [v0, v1, v2] = triangle_vertices(vertices, id);
+                draw_triangle(shader, v0, v1, v2, id, tile_min, tile_max,
+                              depth);
+            }
+        }
+    };
+
+    std::visit(draw_bins, depth_buffer);
+
+    // Shade the tile while it is still in cache.
+    if (shading_mode == ShadingMode::deferred)
+        shade_tile(shader, vertices, tile_min, tile_max);
+}
+
+template <typename V>
+std::array<ScreenVertex<V>, 3>
+Rasterizer::triangle_vertices(std::span<const ScreenVertex<V>> vertices,
+                              std::uint32_t id) const
+{
+    const auto &indices = frame_indices;
+    const auto triangle_count =
+        static_cast<std::uint32_t>(frame_triangle_count);
+
+    if (id < triangle_count)
+        return {vertices[indices[3 * id]], vertices[indices[3 * id + 1]],
+                vertices[indices[3 * id + 2]]};
+
+    // Find the binning thread that produced the clipped triangle.
+    id -= triangle_count;
+    size_t t = 0;
+    while (id >= clipped_first[t + 1])
+        t++;
+
+    const auto &c = clipped[t][id - clipped_first[t]];
+
+    using Varyings = std::array<float, varying_count<V>>;
+    const std::array<Varyings, 3> mesh_varyings{
+        std::bit_cast<Varyings>(vertices[indices[3 * c.triangle]].varying),
+        std::bit_cast<Varyings>(vertices[indices[3 * c.triangle + 1]].varying),
+        std::bit_cast<Varyings>(vertices[indices[3 * c.triangle + 2]].varying)};
+
+    // Varyings are linear in clip space, where the triangle was clipped.
+    std::array<ScreenVertex<V>, 3> out;
+    for (size_t i = 0; i < 3; i++)
+    {
+        Varyings varying;
+        for (size_t k = 0; k < varying.size(); k++)
+            varying[k] = c.weights[i].x * mesh_varyings[0][k] +
+                         c.weights[i].y * mesh_varyings[1][k] +
+                         c.weights[i].z * mesh_varyings[2][k];
+
+        out[i] = {c.positions[i], std::bit_cast<V>(varying)};
+    }
+
+    return out;
+}
+
+// Returns the signed area of the parallelogram spanned by edges p0p1 and p0p2.
+// Given the line p0p1, the edge function has the useful property that:
+//  - edge(p0, p1, p2) = 0 if p2 is on the line,
+//  - edge(p0, p1, p2) > 0 if p2 is above/right of the line,
+//  - edge(p0, p1, p2) < 0 if p2 is under/left of the line.
+inline int edge(IVec2 p0, IVec2 p1, IVec2 p2)
+{
+    return (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+}
+
+// Fixed-point setup of a triangle. Rasterization and the shading pass of
+// deferred shading both derive their attribute planes from it, so that the
+// two shading modes agree on the attributes and their derivatives.
+struct TriangleSetup
+{
+    // Snapped vertices. Back faces are flipped to front faces, the only ones
+    // the coverage test of draw_triangle accepts, by swapping p1 and p2.
+    IVec2 p0, p1, p2;
+    bool flip;
+    // Twice the area, which is zero for degenerate triangles.
+    int area;
+    // Changes of the edge functions per pixel, which decrease to the right
+    // and increase downwards.
+    IVec3 bc_dx, bc_dy;
+    // Added to the edge functions for the top-left fill rule.
+    IVec3 bias;
+    float area_reciprocal;
+};
+
+inline TriangleSetup setup_triangle(Vec4 in0, Vec4 in1, Vec4 in2)
+{
+    constexpr int prec = subpixel_steps;
+
+    TriangleSetup t;
+
+    // Use fixed-point screen coordinates for sub-pixel precision.
+    t.p0 = snap(in0.x, in0.y);
+    t.p1 = snap(in1.x, in1.y);
+    t.p2 = snap(in2.x, in2.y);
+
+    int area = edge(t.p0, t.p1, t.p2);
+
+    t.flip = area < 0;
+    if (t.flip)
+        std::swap(t.p1, t.p2);
+
+    t.area = std::abs(area);
+
+    t.bc_dx = prec * IVec3{t.p2.y - t.p1.y, t.p0.y - t.p2.y, t.p1.y - t.p0.y};
+    t.bc_dy = prec * IVec3{t.p2.x - t.p1.x, t.p0.x - t.p2.x, t.p1.x - t.p0.x};
+
+    // In clockwise order, left edges must go up while top edges stay
+    // horizontal and go right.
+    t.bias =
+        prec * IVec3{t.bc_dy.x > 0 || (t.bc_dy.x == 0 && t.bc_dx.x > 0),
+                     t.bc_dy.y > 0 || (t.bc_dy.y == 0 && t.bc_dx.y > 0),
+                     t.bc_dy.z > 0 || (t.bc_dy.z == 0 && t.bc_dx.z > 0)};
+
+    // 1 / (2 * area of triangle)
+    t.area_reciprocal = 1.f / static_cast<float>(t.area);
+
+    return t;
+}
+
+// Returns the planes of the perspective-correct attributes of a triangle, see
+// perspective_attributes, in the vertex order of its setup.
+template <typename V>
+AttributePlanes<varying_count<V> + 1>
+attribute_planes(const TriangleSetup &setup, const ScreenVertex<V> &v0,
+                 const ScreenVertex<V> &v1, const ScreenVertex<V> &v2)
+{
+    return {perspective_attributes(v0),
+            perspective_attributes(setup.flip ? v2 : v1),
+            perspective_attributes(setup.flip ? v1 : v2),
+            setup.area_reciprocal,
+            setup.bc_dx,
+            setup.bc_dy};
+}
+
+template <ShaderProgram S>
+void Rasterizer::shade_tile(
+    const S &shader,
+    std::span<const ScreenVertex<typename S::Varying>> vertices,
+    IVec2 tile_min, IVec2 tile_max)
+{
+    using Varying = typename S::Varying;
+
+    IVec2 p;
+
+    // Attribute planes of the last shaded triangle.
+    auto triangle = Visibility::no_triangle;
+    AttributePlanes<varying_count<Varying> + 1> planes;
+
+    Visibility *visibility = visibility_buffer->get();
+    Color8 *colors = color_buffer.get();
+
+    // Tiles consist of whole blocks, which every frame buffer shares.
+    for (IVec2 block{tile_min}; block.y <= tile_max.y; block.y += block_size)
+    {
+        for (block.x = tile_min.x; block.x <= tile_max.x;
+             block.x += block_size)
+        {
+            const auto pixels = color_buffer.block(block.x, block.y);
+            const IVec2 block_max{
+                std::min(block.x + block_size, tile_max.x + 1),
+                std::min(block.y + block_size, tile_max.y + 1)};
+
+            for (p.y = block.y; p.y < block_max.y; p.y++)
+            {
+                for (p.x = block.x; p.x < block_max.x; p.x++)
+                {
+                    const auto i = pixels(p.x - block.x, p.y - block.y);
+                    auto &v = visibility[i];
+
+                    if (v.triangle == Visibility::no_triangle)
+                        continue;
+
+                    if (shading)
+                    {
+                        // Neighbouring pixels may belong to other triangles,
+                        // so the derivatives are taken from the planes
+                        // instead of from quads, as in forward shading.
+                        if (v.triangle != triangle)
+                        {
+                            auto [v0, v1, v2] =
+                                triangle_vertices(vertices, v.triangle);
+
+                            planes = attribute_planes(
+                                setup_triangle(v0.position, v1.position,
+                                               v2.position),
+                                v0, v1, v2);
+                            triangle = v.triangle;
+                        }
+
+                        auto fragment = perspective_divide<Varying>(
+                            planes.at(v.edges), planes.dx, planes.dy);
+                        colors[i] = shader.fragment(fragment.in, fragment.dx,
+                                                    fragment.dy);
+                    }
+
+                    if (presented_buffer == BufferType::depth)
+                    {
+                        float key = std::visit(
+                            [&](const auto &depth)
+                            { return float(depth.get()[i]); },
+                            depth_buffer);
+                        colors[i] = to_color8(depth_color(key));
+                    }
+
+                    // Leave the buffer cleared for the next frame.
+                    v.triangle = Visibility::no_triangle;
+                }
+            }
+        }
+    }
+}
+
+#ifdef __AVX2__
+// Depth tests a chunk of 4x2 pixels, see draw_triangle, against two rows of
+// the depth buffer, and stores the keys that pass. Lanes outside of the mask
+// are neither loaded nor stored. Returns the mask of the passing lanes.
+inline __m256i depth_test(float *row0, float *row1, __m256 z, __m256i mask)
+{
+    __m128i mask0 = _mm256_castsi256_si128(mask);
+    __m128i mask1 = _mm256_extracti128_si256(mask, 1);
+
+    __m256 depth = _mm256_set_m128(_mm_maskload_ps(row1, mask1),
+                                   _mm_maskload_ps(row0, mask0));
+
+    __m256i pass = _mm256_and_si256(
+        mask, _mm256_castps_si256(_mm256_cmp_ps(z, depth, _CMP_LT_OQ)));
+
+    _mm_maskstore_ps(row0, _mm256_castsi256_si128(pass),
+                     _mm256_castps256_ps128(z));
+    _mm_maskstore_ps(row1, _mm256_extracti128_si256(pass, 1),
+                     _mm256_extractf128_ps(z, 1));
+
+    return pass;
+}
+
+// Rounds and clamps depth keys like store_depth.
+template <typename D> __m256i unorm_keys(__m256 z)
+{
+    return _mm256_cvtps_epi32(
+        _mm256_min_ps(_mm256_max_ps(z, _mm256_setzero_ps()),
+                      _mm256_set1_ps(static_cast<float>(depth_clear<D>))));
+}
+
+inline __m256i depth_test(std::uint32_t *row0, std::uint32_t *row1, __m256 z,
+                          __m256i mask)
+{
+    __m256i keys = unorm_keys<std::uint32_t>(z);
+
+    auto *r0 = reinterpret_cast<int *>(row0);
+    auto *r1 = reinterpret_cast<int *>(row1);
+    __m128i mask0 = _mm256_castsi256_si128(mask);
+    __m128i mask1 = _mm256_extracti128_si256(mask, 1);
+
+    __m256i depth = _mm256_set_m128i(_mm_maskload_epi32(r1, mask1),
+                                     _mm_maskload_epi32(r0, mask0));
+
+    // Keys are below 2^24, so signed comparisons suffice.
+    __m256i pass = _mm256_and_si256(mask, _mm256_cmpgt_epi32(depth, keys));
+
+    _mm_maskstore_epi32(r0, _mm256_castsi256_si128(pass),
+                        _mm256_castsi256_si128(keys));
+    _mm_maskstore_epi32(r1, _mm256_extracti128_si256(pass, 1),
+                        _mm256_extracti128_si256(keys, 1));
+
+    return pass;
+}
+
+// There are no masked loads and stores of 16-bit values. Fully covered
+// chunks load and store whole rows, other chunks go lane by lane.
+inline __m256i depth_test(std::uint16_t *row0, std::uint16_t *row1, __m256 z,
+                          __m256i mask)
+{
+    __m256i keys = unorm_keys<std::uint16_t>(z);
+    unsigned lanes = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+
+    if (lanes == 0xff)
+    {
+        __m256i depth = _mm256_set_m128i(
+            _mm_cvtepu16_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row1))),
+            _mm_cvtepu16_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row0))));
+
+        __m256i pass = _mm256_cmpgt_epi32(depth, keys);
+
+        // Narrows the lanes of each row to 16 bits in its low 64 bits.
+        __m256i packed =
+            _mm256_packus_epi32(_mm256_blendv_epi8(depth, keys, pass), keys);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(row0),
+                         _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(row1),
+                         _mm256_extracti128_si256(packed, 1));
+
+        return pass;
+    }
+
+    std::uint16_t *rows[2]{row0, row1};
+
+    alignas(32) int depth[8]{};
+    for (unsigned bits = lanes; bits; bits &= bits - 1)
+    {
+        int i = std::countr_zero(bits);
+        depth[i] = rows[i / 4][i % 4];
+    }
+
+    __m256i pass = _mm256_and_si256(
+        mask, _mm256_cmpgt_epi32(
+                  _mm256_load_si256(reinterpret_cast<__m256i *>(depth)), keys));
+
+    alignas(32) int lane_keys[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lane_keys), keys);
+
+    for (unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass)); bits;
+         bits &= bits - 1)
+    {
+        int i = std::countr_zero(bits);
+        rows[i / 4][i % 4] = static_cast<std::uint16_t>(lane_keys[i]);
+    }
+
+    return pass;
+}
+#endif
+
+template <typename D>
+float Rasterizer::farthest_depth(const FrameBuffer<D> &depth, IVec2 block)
+{
+    int block_width = std::min(block_size, width - block.x);
+    int block_height = std::min(block_size, height - block.y);
+
+    const auto pixels = depth.block(block.x, block.y);
+    const D *keys = depth.get();
+
+    D farthest = keys[pixels.first];
+
+    for (int y = 0; y < block_height; y++)
+        for (int x = 0; x < block_width; x++)
+            farthest = std::max(farthest, keys[pixels(x, y)]);
+
+    return static_cast<float>(farthest);
+}
+
+// Parallel implementation of Pineda's triangle rasterization algorithm.
+// https://dl.acm.org/doi/pdf/10.1145/54852.378457
+// https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
+// https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
+// https://scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/
+// https://web.archive.org/web/20130816170418/http://devmaster.net/forums/topic/1145-advanced-rasterization/
+template <ShaderProgram S, typename D>
+void Rasterizer::draw_triangle(const S &shader,
+                               const ScreenVertex<typename S::Varying> &in0,
+                               const ScreenVertex<typename S::Varying> &in1,
+                               const ScreenVertex<typename S::Varying> &in2,
+                               std::uint32_t id, IVec2 tile_min,
+                               IVec2 tile_max, FrameBuffer<D> &depth_buffer)
+{
+    using Varying = typename S::Varying;
+    constexpr size_t n = varying_count<Varying>;
+
+    int prec = subpixel_steps;
+    float fprec = static_cast<float>(prec);
+
+    // Binning rejects triangles of the culled orientation. Back faces that are
+    // kept are flipped to front faces by the setup.
+    const auto setup = setup_triangle(in0.position, in1.position, in2.position);
+    if (setup.area == 0)
+        return;
+
+    const IVec2 &p0 = setup.p0, &p1 = setup.p1, &p2 = setup.p2;
+    const IVec3 &bc_dx = setup.bc_dx, &bc_dy = setup.bc_dy;
+    const IVec3 &bias = setup.bias;
+    const float area_reciprocal = setup.area_reciprocal;
+
+    const auto &v0 = in0;
+    const auto &v1 = setup.flip ? in2 : in1;
+    const auto &v2 = setup.flip ? in1 : in2;
+
+    IVec2 min{std::min({p0.x, p1.x, p2.x}), std::min({p0.y, p1.y, p2.y})};
+    min /= prec;
+    IVec2 max{std::max({p0.x, p1.x, p2.x}), std::max({p0.y, p1.y, p2.y})};
+    max /= prec;
+
+    // Clip triangle to the tile.
+    min.x = std::max(tile_min.x, min.x);
+    min.y = std::max(tile_min.y, min.y);
+
+    max.x = std::min(tile_max.x, max.x);
+    max.y = std::min(tile_max.y, max.y);
+
+    // Pixel centers are located at (0.5, 0.5).
+    IVec2 p{std::round(fprec * (min.x + 0.5f)),
+            std::round(fprec * (min.y + 0.5f))};
+
+    // Edge functions at the first pixel center, stepped incrementally from
+    // there, with the top-left rule bias added.
+    IVec3 bc_row{edge(p1, p2, p), edge(p2, p0, p), edge(p0, p1, p)};
+    bc_row += bias;
+
+    // Depth is linear in screen space, and so are the varyings divided by w
+    // together with 1 / w. Their planes are set up once here and stepped
+    // across blocks like the edge functions. The varyings are only needed for
+    // forward shading.
+    const bool interpolate = shading && shading_mode == ShadingMode::forward;
+
+    // Depth keys are linear in depth, and therefore in screen space too.
+    auto key = [&](float z) { return depth_key.x * z + depth_key.y; };
+
+    const AttributePlanes<1> depth{{key(v0.position.z)},
+                                   {key(v1.position.z)},
+                                   {key(v2.position.z)},
+                                   area_reciprocal,
+                                   bc_dx,
+                                   bc_dy};
+
+    using Attributes = LinearAttributes<Varying>;
+    AttributePlanes<n + 1> planes;
+
+    if (interpolate)
+        planes = attribute_planes(setup, in0, in1, in2);
+
+    Color8 *colors = color_buffer.get();
+    Visibility *visibility =
+        visibility_buffer ? visibility_buffer->get() : nullptr;
+
+    // Shades a covered pixel that passed the depth test, or records it for
+    // the shading pass when shading is deferred. Pixels are given by their
+    // storage index, see FrameBuffer::Block. The interpolated varyings are
+    // only valid for forward shading.
+    auto shade = [&](std::size_t i, IVec3 bc, float z,
+                     const FragmentInput<Varying> &fragment)
+    {
+        if (shading_mode == ShadingMode::deferred)
+        {
+            // The shading pass sets the triangle up again and evaluates the
+            // same planes at these values.
+            visibility[i] = Visibility{id, bc - bias};
+            return;
+        }
+
+        if (shading)
+            colors[i] =
+                shader.fragment(fragment.in, fragment.dx, fragment.dy);
+
+        if (presented_buffer == BufferType::depth)
+            colors[i] = to_color8(depth_color(z));
+    };
+
+#ifdef __AVX2__
+    // Evaluate the edge functions, depth and depth test for chunks of 4x2
+    // pixels at once. Lane i covers pixel (i % 4, i / 4) of the chunk.
+    const __m256i lane_x = _mm256_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3);
+    const __m256i lane_y = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    // Edge function values of the lanes relative to the chunk origin.
+    __m256i lane_bc[3];
+    for (int k = 0; k < 3; k++)
+        lane_bc[k] = _mm256_sub_epi32(
+            _mm256_mullo_epi32(lane_y, _mm256_set1_epi32(bc_dy[k])),
+            _mm256_mullo_epi32(lane_x, _mm256_set1_epi32(bc_dx[k])));
+
+    // Values of the lanes relative to the chunk origin in a linear attribute.
+    auto lane_offsets = [&](float dx, float dy)
+    {
+        return _mm256_add_ps(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(lane_x), _mm256_set1_ps(dx)),
+            _mm256_mul_ps(_mm256_cvtepi32_ps(lane_y), _mm256_set1_ps(dy)));
+    };
+
+    const __m256 z_offsets = lane_offsets(depth.dx[0], depth.dy[0]);
+
+    __m256 attribute_offsets[n + 1];
+    if (interpolate)
+        for (size_t k = 0; k <= n; k++)
+            attribute_offsets[k] = lane_offsets(planes.dx[k], planes.dy[k]);
+
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    const __m256i min_x = _mm256_set1_epi32(min.x - 1);
+    const __m256i max_x = _mm256_set1_epi32(max.x + 1);
+    const __m256i min_y = _mm256_set1_epi32(min.y - 1);
+    const __m256i max_y = _mm256_set1_epi32(max.y + 1);
+
+    // Draws an 8x8 block in 4x2 chunks. Blocks that are known to be covered
+    // by the triangle skip the bounds and edge tests. In partial blocks, lanes
+    // outside the clipped bounding box are masked off.
+    auto draw_block = [&](IVec2 block, IVec3 bc_block, bool covered)
+    {
+        bool written = false;
+        const auto pixels = depth_buffer.block(block.x, block.y);
+        D *depth_pixels = depth_buffer.get();
+
+        // Linear attributes at the block origin. Chunks are offset from here
+        // rather than stepped, which keeps rounding errors from accumulating.
+        const float z_block = depth.at(bc_block - bias)[0];
+
+        Attributes a_block{};
+        if (interpolate)
+            a_block = planes.at(bc_block - bias);
+
+        for (int y = block.y; y < block.y + block_size;
+             y += 2, bc_block += 2 * bc_dy)
+        {
+            auto bc = bc_block;
+
+            __m256i py = _mm256_add_epi32(_mm256_set1_epi32(y), lane_y);
+            __m256i row_mask = _mm256_and_si256(_mm256_cmpgt_epi32(py, min_y),
+                                                _mm256_cmpgt_epi32(max_y, py));
+
+            // The second row may lie outside of the buffer, in which case it
+            // is fully masked and never accessed.
+            D *depth_row0 = depth_pixels + pixels(0, y - block.y);
+            D *depth_row1 = y < max.y ? depth_row0 + pixels.pitch : depth_row0;
+
+            for (int x = block.x; x < block.x + block_size;
+                 x += 4, bc -= 4 * bc_dx)
+            {
+                __m256i w[3];
+                for (int k = 0; k < 3; k++)
+                    w[k] = _mm256_add_epi32(_mm256_set1_epi32(bc[k]),
+                                            lane_bc[k]);
+
+                __m256i mask = all;
+
+                if (!covered)
+                {
+                    __m256i px = _mm256_add_epi32(_mm256_set1_epi32(x), lane_x);
+                    mask = _mm256_and_si256(
+                        row_mask,
+                        _mm256_and_si256(_mm256_cmpgt_epi32(px, min_x),
+                                         _mm256_cmpgt_epi32(max_x, px)));
+
+                    // Draw pixels inside the triangle.
+                    for (int k = 0; k < 3; k++)
+                        mask = _mm256_and_si256(
+                            mask, _mm256_cmpgt_epi32(w[k], zero));
+
+                    if (_mm256_testz_si256(mask, mask))
+                        continue;
+                }
+
+                // Offset of the chunk from the block origin.
+                const auto cx = static_cast<float>(x - block.x);
+                const auto cy = static_cast<float>(y - block.y);
+
+                __m256 z = _mm256_add_ps(
+                    _mm256_set1_ps(z_block + cx * depth.dx[0] +
+                                   cy * depth.dy[0]),
+                    z_offsets);
+
+                __m256i pass = depth_test(depth_row0 + (x - block.x),
+                                          depth_row1 + (x - block.x), z, mask);
+
+                unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+                if (bits == 0)
+                    continue;
+
+                written = true;
+
+                alignas(32) int lane_w[3][8];
+                alignas(32) float lane_z[8];
+
+                for (int k = 0; k < 3; k++)
+                    _mm256_store_si256(reinterpret_cast<__m256i *>(lane_w[k]),
+                                       w[k]);
+                _mm256_store_ps(lane_z, z);
+
+                // Perspective-correct varyings of the lanes and their exact
+                // derivatives, see perspective_divide.
+                alignas(32) float lane_in[n][8];
+                alignas(32) float lane_dx[n][8];
+                alignas(32) float lane_dy[n][8];
+
+                if (interpolate)
+                {
+                    auto attribute = [&](size_t k)
+                    {
+                        return _mm256_add_ps(
+                            _mm256_set1_ps(a_block[k] + cx * planes.dx[k] +
+                                           cy * planes.dy[k]),
+                            attribute_offsets[k]);
+                    };
+
+                    __m256 w_reciprocal = _mm256_div_ps(one, attribute(n));
+                    __m256 w_dx = _mm256_set1_ps(planes.dx[n]);
+                    __m256 w_dy = _mm256_set1_ps(planes.dy[n]);
+
+                    for (size_t k = 0; k < n; k++)
+                    {
+                        __m256 a = _mm256_mul_ps(attribute(k), w_reciprocal);
+
+                        _mm256_store_ps(lane_in[k], a);
+                        _mm256_store_ps(
+                            lane_dx[k],
+                            _mm256_mul_ps(
+                                _mm256_sub_ps(_mm256_set1_ps(planes.dx[k]),
+                                              _mm256_mul_ps(a, w_dx)),
+                                w_reciprocal));
+                        _mm256_store_ps(
+                            lane_dy[k],
+                            _mm256_mul_ps(
+                                _mm256_sub_ps(_mm256_set1_ps(planes.dy[k]),
+                                              _mm256_mul_ps(a, w_dy)),
+                                w_reciprocal));
+                    }
+                }
+
+                for (; bits; bits &= bits - 1)
+                {
+                    int i = std::countr_zero(bits);
+
+                    FragmentInput<Varying> fragment{};
+
+                    if (interpolate)
+                    {
+                        std::array<float, n> in, dx, dy;
+                        for (size_t k = 0; k < n; k++)
+                        {
+                            in[k] = lane_in[k][i];
+                            dx[k] = lane_dx[k][i];
+                            dy[k] = lane_dy[k][i];
+                        }
+
+                        fragment = {std::bit_cast<Varying>(in),
+                                    std::bit_cast<Varying>(dx),
+                                    std::bit_cast<Varying>(dy)};
+                    }
+
+                    shade(pixels(x - block.x + i % 4, y - block.y + i / 4),
+                          IVec3{lane_w[0][i], lane_w[1][i], lane_w[2][i]},
+                          lane_z[i], fragment);
+                }
+            }
+        }
+
+        return written;
+    };
+#else
+    // Adds the derivatives of the linear attributes to step a pixel.
+    auto step = [&](Attributes &a, const Attributes &d)
+    {
+        if (interpolate)
+            for (size_t k = 0; k <= n; k++)
+                a[k] += d[k];
+    };
+
+    // Draws an 8x8 block pixel by pixel. Blocks that are known to be covered
+    // by the triangle skip the bounds and edge tests.
+    auto draw_block = [&](IVec2 block, IVec3 bc_block, bool covered)
+    {
+        bool written = false;
+        IVec2 p;
+
+        const auto pixels = depth_buffer.block(block.x, block.y);
+        D *depth_pixels = depth_buffer.get();
+
+        float z_row = depth.at(bc_block - bias)[0];
+
+        Attributes a_row{};
+        if (interpolate)
+            a_row = planes.at(bc_block - bias);
+
+        for (p.y = block.y; p.y < block.y + block_size; p.y++,
+            bc_block += bc_dy, z_row += depth.dy[0], step(a_row, planes.dy))
+        {
+            auto bc = bc_block;
+            float z = z_row;
+            auto a = a_row;
+
+            for (p.x = block.x; p.x < block.x + block_size;
+                 p.x++, bc -= bc_dx, z += depth.dx[0], step(a, planes.dx))
+            {
+                // Draw pixel if p is inside triangle.
+                if (!covered &&
+                    !(p.x >= min.x && p.x <= max.x && p.y >= min.y &&
+                      p.y <= max.y && bc.x > 0 && bc.y > 0 && bc.z > 0))
+                    continue;
+
+                const auto i = pixels(p.x - block.x, p.y - block.y);
+                D stored = store_depth<D>(z);
+
+                if (stored < depth_pixels[i])
+                {
+                    depth_pixels[i] = stored;
+
+                    FragmentInput<Varying> fragment{};
+                    if (interpolate)
+                        fragment = perspective_divide<Varying>(a, planes.dx,
+                                                               planes.dy);
+
+                    shade(i, bc, z, fragment);
+                    written = true;
+                }
+            }
+        }
+
+        return written;
+    };
+#endif
+
+    // Depth is linear in screen space, so its minimum over a block lies at one
+    // of the block corners. The bound is pulled slightly towards the camera to
+    // stay conservative under rounding.
+    auto nearest_depth = [&](IVec3 c0, IVec3 c1, IVec3 c2, IVec3 c3)
+    {
+        auto depth_at = [&](IVec3 bc) { return depth.at(bc - bias)[0]; };
+
+        float z = std::min(
+            {depth_at(c0), depth_at(c1), depth_at(c2), depth_at(c3)});
+        return z - std::abs(z) * hiz_epsilon;
+    };
+
+    // Coarse pass over 8x8 blocks aligned to the block size. The edge
+    // functions are linear, so their extrema over a block lie at its corners.
+    // Blocks outside any edge are rejected and blocks inside all edges are
+    // drawn without per-pixel coverage tests. Blocks that are hidden behind
+    // the farthest depth stored in the hierarchical depth buffer are rejected
+    // before any pixel is touched.
+    IVec2 start{min.x & ~(block_size - 1), min.y & ~(block_size - 1)};
+    bc_row += (start.y - min.y) * bc_dy - (start.x - min.x) * bc_dx;
+
+    // Edge function offsets from the first pixel of a block to its corners.
+    const IVec3 right = -(block_size - 1) * bc_dx;
+    const IVec3 down = (block_size - 1) * bc_dy;
+
+    for (IVec2 block{start.x, start.y}; block.y <= max.y;
+         block.y += block_size, bc_row += block_size * bc_dy)
+    {
+        auto bc = bc_row;
+
+        for (block.x = start.x; block.x <= max.x;
+             block.x += block_size, bc -= block_size * bc_dx)
+        {
+            bool outside = false;
+            bool inside = true;
+
+            for (int k = 0; k < 3; k++)
+            {
+                auto [lo, hi] = std::minmax({bc[k], bc[k] + right[k],
+                                             bc[k] + down[k],
+                                             bc[k] + right[k] + down[k]});
+                outside |= hi <= 0;
+                inside &= lo > 0;
+            }
+
+            if (outside)
+                continue;
+
+            float &farthest =
+                hiz_buffer(block.x / block_size, block.y / block_size);
+
+            if (nearest_depth(bc, bc + right, bc + down, bc + right + down) >=
+                farthest)
+                continue;
+
+            bool inside_bounds =
+                block.x >= min.x && block.y >= min.y &&
+                block.x + block_size - 1 <= max.x &&
+                block.y + block_size - 1 <= max.y;
+
+            // Depth values only ever decrease, so does the farthest depth.
+            if (draw_block(block, bc, inside && inside_bounds))
+                farthest = farthest_depth(depth_buffer, block);
+        }
+    }
+}
+
+} // namespace rasterizer
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "scene.hpp"
+
+using namespace rasterizer;
+
+Sphere rasterizer::bounding_sphere(const Bounds &bounds)
+{
+    return Sphere{0.5f * (bounds.min + bounds.max),
+                  0.5f * (bounds.max - bounds.min).magnitude()};
+}
+
+Sphere rasterizer::transform(const Mat4 &m, const Sphere &sphere)
+{
+    // The largest scale along any axis bounds the scaled radius.
+    float scale = 0.f;
+    for (int j = 0; j < 3; j++)
+        scale = std::max(scale, Vec3{m[0][j], m[1][j], m[2][j]}.magnitude());
+
+    return Sphere{(m * Vec4{sphere.center, 1.f}).xyz, scale * sphere.radius};
+}
+
+Meshlets::Meshlets(const Mesh &mesh)
+{
+    constexpr auto none = std::numeric_limits<std::uint32_t>::max();
+
+    // Index of every mesh vertex in the current meshlet if it is copied, or
+    // none if it is not part of it.
+    std::vector<std::uint32_t> slots;
+    // Mesh vertex indices of the triangles of the current meshlet.
+    std::vector<std::uint32_t> corners;
+
+    indices.reserve(mesh.indices.size());
+
+    Meshlet meshlet{};
+    // Last vertex of the range of the current meshlet, unless it is copied.
+    std::uint32_t last_vertex = 0;
+
+    auto finish = [&]
+    {
+        Bounds bounds{Vec3{std::numeric_limits<float>::infinity()},
+                      Vec3{-std::numeric_limits<float>::infinity()}};
+
+        for (auto i : corners)
+        {
+            const auto &p = mesh.vertices[i].position;
+
+            for (int k = 0; k < 3; k++)
+            {
+                bounds.min[k] = std::min(bounds.min[k], p[k]);
+                bounds.max[k] = std::max(bounds.max[k], p[k]);
+            }
+
+            indices.push_back(static_cast<std::uint8_t>(
+                meshlet.copied ? slots[i] : i - meshlet.first_vertex));
+        }
+
+        if (meshlet.copied)
+            for (auto i : corners)
+                slots[i] = none;
+
+        meshlet.bounds = bounding_sphere(bounds);
+        meshlets.push_back(meshlet);
+        corners.clear();
+    };
+
+    for (std::uint32_t t = 0; t < mesh.triangle_count(); t++)
+    {
+        const auto *index = &mesh.indices[3 * t];
+        const auto [low, high] = std::minmax({index[0], index[1], index[2]});
+
+        bool fits = meshlet.triangle_count > 0 &&
+                    meshlet.triangle_count < meshlet_max_triangles;
+
+        if (fits && meshlet.copied)
+        {
+            std::uint32_t new_vertices = 0;
+            for (int k = 0; k < 3; k++)
+                new_vertices += slots[index[k]] == none &&
+                                (k < 1 || index[k] != index[0]) &&
+                                (k < 2 || index[k] != index[1]);
+
+            fits = meshlet.vertex_count + new_vertices <= meshlet_max_vertices;
+        }
+        else if (fits)
+        {
+            fits = std::max(last_vertex, high) -
+                       std::min(meshlet.first_vertex, low) <
+                   meshlet_max_vertices;
+        }
+
+        if (!fits)
+        {
+            if (meshlet.triangle_count > 0)
+                finish();
+
+            meshlet = Meshlet{low, 0, t, 0, Sphere{}, false};
+            last_vertex = high;
+
+            if (high - low >= meshlet_max_vertices)
+            {
+                meshlet.first_vertex =
+                    static_cast<std::uint32_t>(copies.size());
+                meshlet.copied = true;
+
+                if (slots.empty())
+                    slots.resize(mesh.vertices.size(), none);
+            }
+        }
+
+        if (meshlet.copied)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                if (slots[index[k]] == none)
+                {
+                    slots[index[k]] = meshlet.vertex_count++;
+                    copies.push_back(mesh.vertices[index[k]]);
+                }
+            }
+        }
+        else
+        {
+            meshlet.first_vertex = std::min(meshlet.first_vertex, low);
+            last_vertex = std::max(last_vertex, high);
+            meshlet.vertex_count = last_vertex - meshlet.first_vertex + 1;
+        }
+
+        corners.insert(corners.end(), index, index + 3);
+        meshlet.triangle_count++;
+    }
+
+    if (meshlet.triangle_count > 0)
+        finish();
+}
+
+Frustum::Frustum(const Mat4 &projection, bool reversed_z, bool far_plane)
+    : plane_count{far_plane ? planes.size() : planes.size() - 1}
+{
+    const auto &m = projection;
+
+    // A point lies inside if -w <= x, y, z <= w in clip space, i.e. if the
+    // dot products with the sum and difference of the last row and the
+    // others are not negative.
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            float sign = j == 0 ? 1.f : -1.f;
+            Vec4 plane{m[3][0] + sign * m[i][0], m[3][1] + sign * m[i][1],
+                       m[3][2] + sign * m[i][2], m[3][3] + sign * m[i][3]};
+
+            // Normalize, so that dot products are distances.
+            planes[2 * i + j] = plane * (1.f / plane.xyz.magnitude());
+        }
+    }
+
+    // Depth lies in [0, w] instead, with the near plane at z = w.
+    if (reversed_z)
+    {
+        Vec4 far{m[2][0], m[2][1], m[2][2], m[2][3]};
+        Vec4 near{m[3][0] - m[2][0], m[3][1] - m[2][1], m[3][2] - m[2][2],
+                  m[3][3] - m[2][3]};
+
+        planes[4] = near * (1.f / near.xyz.magnitude());
+        planes[5] = far * (1.f / far.xyz.magnitude());
+    }
+}
+
+bool Frustum::intersects(const Sphere &sphere) const
+{
+    for (std::size_t i = 0; i < plane_count; i++)
+        if (dot(planes[i].xyz, sphere.center) + planes[i].w < -sphere.radius)
+            return false;
+
+    return true;
+}
+
+Scene::Scene(Model &&model) { add_instance(add_model(std::move(model))); }
+
+std::size_t Scene::add_model(Model &&model)
+{
+    Meshlets meshlets{*model.mesh};
+    Sphere bounds = bounding_sphere(model.mesh->bounds);
+
+    models.push_back(Entry{std::move(model), std::move(meshlets), bounds});
+    return models.size() - 1;
+}
+
+void Scene::add_instance(std::size_t model, const Mat4 &transform)
+{
+    instances.push_back(Instance{model, transform});
+}
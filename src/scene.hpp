@@ -0,0 +1,130 @@
+// Collection of models drawn as instances, with the bounds that let the
+// rasterizer cull whatever lies outside the view frustum.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "matrix.hpp"
+#include "model.hpp"
+#include "vector.hpp"
+
+namespace rasterizer
+{
+
+struct Sphere
+{
+    Vec3 center;
+    float radius;
+};
+
+// Returns the smallest sphere enclosing the box.
+Sphere bounding_sphere(const Bounds &bounds);
+
+// Returns the bounds of the sphere after an affine transform, which may scale
+// non-uniformly.
+Sphere transform(const Mat4 &m, const Sphere &sphere);
+
+// Limits of meshlets, so that their vertices can be addressed with 8 bits.
+constexpr std::size_t meshlet_max_vertices = 256;
+constexpr std::size_t meshlet_max_triangles = 512;
+
+// Cluster of consecutive triangles of a mesh with its own range of vertices.
+struct Meshlet
+{
+    // Range of vertices in the mesh, or in Meshlets::copies if copied is set.
+    std::uint32_t first_vertex;
+    std::uint32_t vertex_count;
+    // Range of triangles in the mesh, and in Meshlets::indices.
+    std::uint32_t first_triangle;
+    std::uint32_t triangle_count;
+
+    Sphere bounds;
+    bool copied;
+};
+
+// Mesh split into meshlets, which are culled as a whole. Meshlets address
+// ranges of the vertices of the mesh itself, which overlap where meshlets
+// share vertices and may include vertices that the meshlet does not use.
+// Only triangles whose vertices lie too far apart in the mesh for 8-bit
+// indices end up in meshlets of copied vertices.
+struct Meshlets
+{
+    std::vector<Meshlet> meshlets;
+    // Vertices of the copied meshlets.
+    std::vector<Vertex> copies;
+    // Three per triangle, relative to the first vertex of its meshlet.
+    std::vector<std::uint8_t> indices;
+
+    explicit Meshlets(const Mesh &mesh);
+
+    // Returns the vertices of a meshlet of the given mesh.
+    std::span<const Vertex> vertices(const Mesh &mesh,
+                                     const Meshlet &meshlet) const
+    {
+        return (meshlet.copied ? std::span{copies} : mesh.vertices)
+            .subspan(meshlet.first_vertex, meshlet.vertex_count);
+    }
+};
+
+// Planes of a view frustum, with normals pointing inwards.
+// https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+class Frustum
+{
+    // The far plane comes last.
+    std::array<Vec4, 6> planes;
+    std::size_t plane_count;
+
+  public:
+    // Extracts the planes in the space that the matrix projects from. With
+    // reversed-Z, clip-space depth lies in [0, w] instead of [-w, w], see
+    // perspective(). Without the far plane, the frustum extends to infinity,
+    // as it does for rasterizers that don't clip at the far plane.
+    explicit Frustum(const Mat4 &projection, bool reversed_z = false,
+                     bool far_plane = true);
+
+    // Returns false if the sphere lies entirely outside of a plane. Spheres
+    // near corners of the frustum may pass without intersecting it.
+    bool intersects(const Sphere &sphere) const;
+};
+
+struct Instance
+{
+    std::size_t model;
+    // Model to world space.
+    Mat4 transform;
+};
+
+// Models with their meshlets, drawn once per instance.
+class Scene
+{
+  public:
+    struct Entry
+    {
+        Model model;
+        Meshlets meshlets;
+        Sphere bounds;
+    };
+
+  private:
+    std::vector<Entry> models;
+    std::vector<Instance> instances;
+
+  public:
+    Scene() = default;
+    // Scene with a single instance of the model without transform.
+    explicit Scene(Model &&model);
+
+    // Returns the index by which instances refer to the model.
+    std::size_t add_model(Model &&model);
+    void add_instance(std::size_t model, const Mat4 &transform = Mat4{1.f});
+
+    std::span<const Entry> get_models() const { return models; }
+    std::span<const Instance> get_instances() const { return instances; }
+};
+
+} // namespace rasterizer
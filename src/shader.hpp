@@ -1,44 +1,156 @@
 #pragma once
 
-#include "matrix.hpp"
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
 #include "model.hpp"
 #include "vector.hpp"
 
 namespace rasterizer
 {
 
-struct Varying
+// Number of floats in a varying type.
+template <typename V>
+constexpr std::size_t varying_count = sizeof(V) / sizeof(float);
+
+// Requirements on the shaders that Rasterizer::draw accepts. The rasterizer
+// is instantiated for every shader type, so that shader calls are inlined into
+// its raster loop instead of going through virtual functions.
+//
+// Vertex positions are transformed to screen space by the rasterizer. Shaders
+// only declare and compute their Varying type:
+//  - vertex() returns the varyings of a mesh vertex,
+//  - fragment() returns the color of a pixel from its perspective-correct
+//    varyings and their screen-space derivatives along x and y.
+// The rasterizer interpolates varyings as arrays of floats, so they must only
+// have float members such as float, Vec2 and Vec3. Shaders are called from
+// several threads at once, hence through const references only.
+template <typename S>
+concept ShaderProgram =
+    std::default_initializable<typename S::Varying> &&
+    std::is_trivially_copyable_v<typename S::Varying> &&
+    sizeof(typename S::Varying) % sizeof(float) == 0 &&
+    alignof(typename S::Varying) == alignof(float) &&
+    requires(const S &shader, const Vertex &vertex,
+             const typename S::Varying &v) {
+        {
+            shader.uniforms
+        } -> std::convertible_to<const typename S::Uniforms &>;
+        { shader.vertex(vertex) } -> std::same_as<typename S::Varying>;
+        { shader.fragment(v, v, v) } -> std::same_as<Color8>;
+    };
+
+// Converts a color with components in [0, 1] to 8 bits per component.
+inline Color8 to_color8(Color c)
+{
+    auto convert = [](float f)
+    { return static_cast<std::uint8_t>(std::clamp(f, 0.f, 1.f) * 255.f); };
+
+    return Color8{convert(c.r), convert(c.g), convert(c.b), convert(c.a)};
+}
+
+// Unlit shading with the diffuse texture, or white without one.
+struct TextureShader
 {
-    Vec4 position;
-    Vec3 normal;
-    Vec2 uv;
+    struct Varying
+    {
+        Vec2 uv;
+    };
+
+    struct Uniforms
+    {
+        const Texture *texture = nullptr;
+    };
+
+    Uniforms uniforms;
+
+    Varying vertex(const Vertex &in) const { return Varying{in.uv}; }
+
+    Color8 fragment(const Varying &in, const Varying &dx,
+                    const Varying &dy) const
+    {
+        if (uniforms.texture)
+            return uniforms.texture->sample(
+                in.uv, uniforms.texture->lod(dx.uv, dy.uv));
+        else
+            return Color8{255};
+    }
 };
 
-struct Uniforms
+// Diffuse lighting by a directional light, modulating the diffuse texture if
+// there is one.
+struct LambertShader
 {
-    Mat4 mvp;
-    Texture *texture;
+    struct Varying
+    {
+        Vec3 normal;
+        Vec2 uv;
+    };
+
+    struct Uniforms
+    {
+        const Texture *texture = nullptr;
+        // Normalized direction towards the light in model space.
+        Vec3 light_direction = normalize(Vec3{1.f, 2.f, 1.f});
+        float ambient = 0.1f;
+    };
+
+    Uniforms uniforms;
+
+    Varying vertex(const Vertex &in) const
+    {
+        return Varying{in.normal, in.uv};
+    }
+
+    Color8 fragment(const Varying &in, const Varying &dx,
+                    const Varying &dy) const
+    {
+        Color albedo = colors::white;
+
+        if (uniforms.texture)
+        {
+            Color8 t = uniforms.texture->sample(
+                in.uv, uniforms.texture->lod(dx.uv, dy.uv));
+            albedo = Color{t.r / 255.f, t.g / 255.f, t.b / 255.f, 1.f};
+        }
+
+        float diffuse = std::max(
+            0.f, dot(normalize(in.normal), uniforms.light_direction));
+        float light = uniforms.ambient + (1.f - uniforms.ambient) * diffuse;
+
+        return to_color8(Color{albedo.r * light, albedo.g * light,
+                               albedo.b * light, 1.f});
+    }
 };
 
-// TODO: The shader logic is fixed for now, you should be able to define custom
-// shaders. However, we would like to avoid the overhead of virtual functions.
-class Shader
+// Debug view mapping model-space normals from [-1, 1] to colors.
+struct NormalShader
 {
-    // Viewport information.
-    int width;
-    int height;
+    struct Varying
+    {
+        Vec3 normal;
+    };
+
+    struct Uniforms
+    {
+    };
 
-  public:
     Uniforms uniforms;
 
-    Shader(int width, int height);
+    Varying vertex(const Vertex &in) const { return Varying{in.normal}; }
 
-    // Pipeline
-    Varying vertex(const Vertex &in);
-    void post_process(Varying &v);
-    Varying vary(Vec3 bc, const Varying &v0, const Varying &v1,
-                 const Varying &v2);
-    Color8 fragment(const Varying &in);
+    Color8 fragment(const Varying &in, const Varying &, const Varying &) const
+    {
+        Vec3 n = 0.5f * normalize(in.normal) + Vec3{0.5f};
+        return to_color8(Color{n.x, n.y, n.z, 1.f});
+    }
 };
 
-} // namespace rasterizer
\ No newline at end of file
+static_assert(ShaderProgram<TextureShader>);
+static_assert(ShaderProgram<LambertShader>);
+static_assert(ShaderProgram<NormalShader>);
+
+} // namespace rasterizer
@@ -0,0 +1,87 @@
+#include "thread_pool.hpp"
+
+using namespace rasterizer;
+
+ThreadPool::ThreadPool(std::size_t thread_count)
+{
+    // hardware_concurrency() is allowed to return 0 when it can't tell.
+    for (std::size_t i = 1; i < thread_count; i++)
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+
+    work_available.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::parallel_for(std::size_t count, const Job &f)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1)
+    {
+        for (std::size_t i = 0; i < count; i++)
+            f(i, 0);
+
+        return;
+    }
+
+    {
+        std::lock_guard lock{mutex};
+        job = &f;
+        job_size = count;
+        next_index = 0;
+        active = workers.size();
+        generation++;
+    }
+
+    work_available.notify_all();
+
+    run_job(0);
+
+    std::unique_lock lock{mutex};
+    work_done.wait(lock, [this] { return active == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::worker_loop(std::size_t thread)
+{
+    std::size_t seen_generation = 0;
+
+    while (true)
+    {
+        std::unique_lock lock{mutex};
+        work_available.wait(lock, [&] {
+            return stopping || generation != seen_generation;
+        });
+
+        if (stopping)
+            return;
+
+        seen_generation = generation;
+
+        lock.unlock();
+        run_job(thread);
+        lock.lock();
+
+        if (--active == 0)
+            work_done.notify_one();
+    }
+}
+
+void ThreadPool::run_job(std::size_t thread)
+{
+    // Work items are handed out dynamically, which balances tiles with very
+    // different amounts of geometry.
+    for (std::size_t i; (i = next_index++) < job_size;)
+        (*job)(i, thread);
+}
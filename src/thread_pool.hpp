@@ -0,0 +1,80 @@
+// Fixed-size pool of worker threads for the data-parallel pipeline stages.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rasterizer
+{
+
+class ThreadPool
+{
+  public:
+    // Called with the work item index and the index of the executing thread.
+    // Thread indices lie in [0, size()) and can be used to address per-thread
+    // scratch storage. Refers to the callable passed to parallel_for(), which
+    // outlives the call, so unlike std::function it never allocates.
+    class Job
+    {
+        const void *f;
+        void (*call)(const void *f, std::size_t i, std::size_t thread);
+
+      public:
+        // Copies of a Job refer to the same callable instead of to the Job.
+        template <typename F>
+        requires(!std::is_same_v<std::remove_cvref_t<F>, Job>)
+        Job(const F &f)
+            : f{&f}, call{[](const void *f, std::size_t i, std::size_t thread)
+                          { (*static_cast<const F *>(f))(i, thread); }}
+        {
+        }
+
+        void operator()(std::size_t i, std::size_t thread) const
+        {
+            call(f, i, thread);
+        }
+    };
+
+  private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+
+    const Job *job = nullptr;
+    std::size_t job_size = 0;
+    std::atomic<std::size_t> next_index = 0;
+
+    // Number of workers that have not finished the current job yet.
+    std::size_t active = 0;
+    // Incremented for every job so that sleeping workers can tell new work
+    // apart from spurious wake-ups.
+    std::size_t generation = 0;
+    bool stopping = false;
+
+    void worker_loop(std::size_t thread);
+    void run_job(std::size_t thread);
+
+  public:
+    explicit ThreadPool(
+        std::size_t thread_count = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    // Number of threads taking part in a job, including the calling thread.
+    std::size_t size() const { return workers.size() + 1; }
+
+    // Runs f for every index in [0, count) and blocks until all calls have
+    // returned. The calling thread takes part in the work as thread 0.
+    void parallel_for(std::size_t count, const Job &f);
+};
+
+} // namespace rasterizer
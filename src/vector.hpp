@@ -10,20 +10,39 @@
 #include <cstdint>
 #include <numeric>
 #include <ostream>
+#include <type_traits>
 #include <utility>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 using std::array;
 
 namespace rasterizer
 {
 
+template <typename T, size_t n> struct Vector;
+
+// Vectors of four floats are kept 16-byte aligned and backed by SSE
+// arithmetic, except during constant evaluation.
+#ifdef __SSE__
+template <typename Vec>
+constexpr bool is_simd = std::is_same_v<Vec, Vector<float, 4>>;
+#else
+template <typename Vec> constexpr bool is_simd = false;
+#endif
+
 // We use CRTP to avoid code duplication when writing template specializations.
 // Operations are hidden friends to support heterogeneous arithmetic through
 // implicit type conversion of arguments.
 template <typename Vec, typename T> struct VectorBase
 {
-    Vec &self() { return static_cast<Vec &>(*this); }
-    const Vec &self() const { return static_cast<const Vec &>(*this); }
+    constexpr Vec &self() { return static_cast<Vec &>(*this); }
+    constexpr const Vec &self() const
+    {
+        return static_cast<const Vec &>(*this);
+    }
 
     // Iterators
     constexpr auto begin() const noexcept { return self().data.begin(); }
@@ -65,6 +84,10 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator+=(const Vec &v)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_add_ps(self().load(), v.load()));
+
         for (size_t i = 0; i < Vec::size; i++)
             self()[i] += v[i];
 
@@ -73,6 +96,10 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator-=(const Vec &v)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_sub_ps(self().load(), v.load()));
+
         for (size_t i = 0; i < Vec::size; i++)
             self()[i] -= v[i];
 
@@ -81,6 +108,10 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator*=(const Vec &v)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_mul_ps(self().load(), v.load()));
+
         for (size_t i = 0; i < Vec::size; i++)
             self()[i] *= v[i];
 
@@ -89,8 +120,12 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator/=(const Vec &v)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_div_ps(self().load(), v.load()));
+
         for (size_t i = 0; i < Vec::size; i++)
-            self() /= v[i];
+            self()[i] /= v[i];
 
         return self();
     }
@@ -106,6 +141,10 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator*=(const T &s)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_mul_ps(self().load(), _mm_set1_ps(s)));
+
         for (size_t i = 0; i < Vec::size; i++)
             self()[i] *= s;
 
@@ -114,6 +153,10 @@ template <typename Vec, typename T> struct VectorBase
 
     constexpr Vec &operator/=(const T &s)
     {
+        if constexpr (is_simd<Vec>)
+            if (!std::is_constant_evaluated())
+                return self().store(_mm_div_ps(self().load(), _mm_set1_ps(s)));
+
         for (size_t i = 0; i < Vec::size; i++)
             self()[i] /= s;
 
@@ -143,6 +186,22 @@ template <typename Vec, typename T> struct VectorBase
 
     friend constexpr auto dot(Vec v1, const Vec &v2)
     {
+#ifdef __SSE__
+        if constexpr (is_simd<Vec>)
+        {
+            if (!std::is_constant_evaluated())
+            {
+                // Sum the products in the same order as the loop below, so
+                // that results don't depend on the code path.
+                __m128 p = _mm_mul_ps(v1.load(), v2.load());
+                __m128 sum = _mm_add_ss(p, _mm_shuffle_ps(p, p, 1));
+                sum = _mm_add_ss(sum, _mm_shuffle_ps(p, p, 2));
+                sum = _mm_add_ss(sum, _mm_shuffle_ps(p, p, 3));
+                return _mm_cvtss_f32(sum);
+            }
+        }
+#endif
+
         T product_sum{};
 
         // Dot product is the sum of the product of corresponding elements.
@@ -208,6 +267,8 @@ template <typename T> struct Vector<T, 3> : VectorBase<Vector<T, 3>, T>
 {
     static constexpr int size = 3;
 
+    constexpr Vector() = default;
+
     constexpr Vector(const T &e1, const T &e2, const T &e3) : data{e1, e2, e3}
     {
     }
@@ -292,9 +353,22 @@ template <typename T> struct Vector<T, 4> : VectorBase<Vector<T, 4>, T>
     {
     }
 
+#ifdef __SSE__
+    __m128 load() const requires(std::is_same_v<T, float>)
+    {
+        return _mm_load_ps(data.data());
+    }
+
+    Vector &store(__m128 m) requires(std::is_same_v<T, float>)
+    {
+        _mm_store_ps(data.data(), m);
+        return *this;
+    }
+#endif
+
     union
     {
-        array<T, 4> data;
+        alignas(std::is_same_v<T, float> ? 16 : alignof(T)) array<T, 4> data;
 
         struct
         {
@@ -0,0 +1,243 @@
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include <SDL2/SDL.h>
+#include <SDL_keycode.h>
+#include <SDL_messagebox.h>
+#include <SDL_mouse.h>
+#include <SDL_render.h>
+#include <SDL_timer.h>
+#include <SDL_video.h>
+
+#include "utils.hpp"
+#include "viewer.hpp"
+
+using std::round;
+
+using namespace rasterizer;
+using namespace utils;
+
+static IVec2 get_mouse_position()
+{
+    int x, y;
+    SDL_GetMouseState(&x, &y);
+    return IVec2{x, y};
+}
+
+static int middle_mouse_down()
+{
+    return SDL_GetMouseState(nullptr, nullptr) & SDL_BUTTON_MIDDLE;
+}
+
+Viewer::Viewer(int width, int height, Model &&model)
+    : width{width}, height{height}, rasterizer{width, height, std::move(model)},
+      camera{Vec3{0.f, 2.f, 2.f}, Vec3{0.f}}, frame_camera{camera}
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        throw std::runtime_error("Failed to initialize SDL.");
+
+    SDL_CreateWindowAndRenderer(width, height, 0, &window, &renderer);
+    color_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                      SDL_TEXTUREACCESS_STREAMING, width,
+                                      height);
+}
+
+Viewer::~Viewer()
+{
+    stop_rendering();
+
+    SDL_DestroyWindow(window);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyTexture(color_texture);
+
+    SDL_Quit();
+}
+
+void Viewer::render_loop()
+{
+    std::unique_lock lock{render_mutex};
+
+    while (true)
+    {
+        render_requested.wait(lock,
+                              [this] { return frame_pending || stopping; });
+        if (stopping)
+            return;
+
+        lock.unlock();
+
+        try
+        {
+            rasterizer.draw(frame_camera);
+        }
+        catch (...)
+        {
+            frame_error = std::current_exception();
+        }
+
+        lock.lock();
+        frame_pending = false;
+        render_done.notify_one();
+    }
+}
+
+void Viewer::stop_rendering()
+{
+    if (!render_thread.joinable())
+        return;
+
+    {
+        std::lock_guard lock{render_mutex};
+        stopping = true;
+    }
+
+    render_requested.notify_one();
+    render_thread.join();
+}
+
+// Frames are pipelined: while a frame is drawn on the render thread, the
+// previous one is uploaded and presented from the back buffers, which are
+// then cleared for reuse. Presentation therefore lags input by one frame.
+void Viewer::run()
+{
+    bool close_window = false;
+
+    rasterizer.draw(camera);
+
+    stopping = false;
+    render_thread = std::thread{&Viewer::render_loop, this};
+
+    while (!close_window)
+    {
+
+        // Event polling
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            switch (event.type)
+            {
+            case SDL_QUIT:
+                close_window = true;
+                break;
+            case SDL_KEYDOWN:
+                switch (event.key.keysym.sym)
+                {
+                case SDLK_f:
+                    if (rasterizer.get_presented_buffer() == BufferType::color)
+                        rasterizer.set_presented_buffer(BufferType::depth);
+                    else
+                        rasterizer.set_presented_buffer(BufferType::color);
+
+                    break;
+                }
+                break;
+            case SDL_MOUSEWHEEL:
+                camera.zoom(event.wheel.y);
+                camera.update(Vec2{0});
+            }
+        }
+
+        auto new_mouse_position = get_mouse_position();
+
+        if (middle_mouse_down())
+            camera.update(new_mouse_position - mouse_position);
+
+        mouse_position = new_mouse_position;
+
+        // The rasterizer must not be reconfigured until the frame is done.
+        rasterizer.swap_buffers();
+
+        {
+            std::lock_guard lock{render_mutex};
+            frame_camera = camera;
+            frame_pending = true;
+        }
+
+        render_requested.notify_one();
+
+        // Converting to the linear layout happens while uploading.
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(color_texture, nullptr, &pixels, &pitch) == 0)
+        {
+            rasterizer.get_back_color_buffer().copy_linear(
+                static_cast<Color8 *>(pixels), pitch / sizeof(Color8));
+            SDL_UnlockTexture(color_texture);
+        }
+
+        set_color(clear_color);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, color_texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+
+        rasterizer.clear_back_buffers();
+
+        {
+            std::unique_lock lock{render_mutex};
+            render_done.wait(lock, [this] { return !frame_pending; });
+        }
+
+        if (frame_error)
+            std::rethrow_exception(std::exchange(frame_error, nullptr));
+
+        // Show FPS.
+        int tick = SDL_GetTicks();
+        int fps = 1000.f / (tick - prev_tick);
+        prev_tick = tick;
+
+        // Clear and return to beginning of line.
+        std::cout << "\33[2K\r" << fps << std::flush;
+    }
+
+    stop_rendering();
+}
+
+void Viewer::draw_point(IVec2 p) { SDL_RenderDrawPoint(renderer, p.x, p.y); }
+
+// Integer-only implementation of Bresenham's line algorithm.
+// https://www.cs.helsinki.fi/group/goa/mallinnus/lines/bresenh.html
+void Viewer::draw_line(IVec2 p1, IVec2 p2)
+{
+    if (!in_bounds(p1.x, 0, width) || !in_bounds(p2.x, 0, width) ||
+        !in_bounds(p1.y, 0, height) || !in_bounds(p1.y, 0, height))
+        return;
+
+    bool mirror = false;
+    if (std::abs(p1.x - p2.x) < std::abs(p1.y - p2.y))
+    {
+        std::swap(p1.x, p1.y);
+        std::swap(p2.x, p2.y);
+        mirror = true;
+    }
+
+    // Keep the invariant property that p1 lay left of p2.
+    if (p1.x > p2.x)
+        std::swap(p1, p2);
+
+    auto d = p2 - p1;
+
+    // ie = 2*e*dx, where e is the actual accumulated error so far.
+    // We keep track of this term since it's always an integer, unlike e.
+    int ie = 0;
+
+    // Move from left to right, drawing the point to the right or to the
+    // top/bottom right of the previous point based on the current error.
+    do
+    {
+        draw_point((mirror) ? p1.swap() : p1);
+
+        ie += std::abs(d.y);
+        if (2 * ie >= d.x)
+        {
+            p1.y += (d.y >= 0) ? 1 : -1;
+            ie -= d.x;
+        }
+    } while (++p1.x <= p2.x);
+}
+
+void Viewer::set_color(Color color)
+{
+    SDL_SetRenderDrawColor(renderer, round(color.r * 255), round(color.g * 255),
+                           round(color.b * 255), round(color.a * 255));
+}
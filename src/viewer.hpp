@@ -0,0 +1,68 @@
+// Interactive SDL front end presenting the rasterizer output in a window.
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <SDL2/SDL.h>
+#include <SDL_timer.h>
+
+#include "camera.hpp"
+#include "model.hpp"
+#include "rasterizer.hpp"
+#include "vector.hpp"
+
+namespace rasterizer
+{
+
+class Viewer
+{
+  private:
+    int width;
+    int height;
+
+    Rasterizer rasterizer;
+    Color clear_color = Color{0, 0, 0, 255};
+
+    Camera camera;
+    IVec2 mouse_position;
+
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *color_texture;
+
+    uint prev_tick;
+
+    // Draws frames in the background while run() presents the previous one.
+    // It sleeps until run() sets frame_pending, and resets it once the frame
+    // is drawn.
+    std::thread render_thread;
+    std::mutex render_mutex;
+    std::condition_variable render_requested;
+    std::condition_variable render_done;
+    // Camera of the pending frame.
+    Camera frame_camera;
+    bool frame_pending = false;
+    bool stopping = false;
+    // Exception thrown while drawing the last frame, rethrown by run().
+    std::exception_ptr frame_error;
+
+    void render_loop();
+    void stop_rendering();
+
+  public:
+    Viewer(int width, int height, Model &&model);
+    Viewer(const Viewer &v) = delete;
+    Viewer &operator=(const Viewer &v) = delete;
+    ~Viewer();
+
+    void run();
+    void draw_line(IVec2 p1, IVec2 p2);
+    void draw_point(IVec2 p);
+    void set_color(Color color);
+};
+
+} // namespace rasterizer
@@ -0,0 +1,299 @@
+// Regression tests of the rasterizer, which render small scenes offscreen and
+// compare the results. Run with ctest.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "camera.hpp"
+#include "model.hpp"
+#include "rasterizer.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
+
+using namespace rasterizer;
+
+using std::vector;
+
+static int failures = 0;
+
+static void check(bool condition, std::string_view message)
+{
+    if (condition)
+        return;
+
+    std::cerr << "FAILED: " << message << std::endl;
+    failures++;
+}
+
+static Model make_model(vector<Vertex> vertices, vector<uint32_t> indices)
+{
+    Model model{};
+    model.mesh =
+        std::make_unique<Mesh>(std::move(vertices), std::move(indices));
+    return model;
+}
+
+// Returns the number of pixels whose channels differ by more than one step.
+static size_t count_differences(const vector<Color8> &a,
+                                const vector<Color8> &b)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        for (size_t k = 0; k < 4; k++)
+            if (std::abs(a[i][k] - b[i][k]) > 1)
+            {
+                count++;
+                break;
+            }
+
+    return count;
+}
+
+// Returns the number of pixels that are not cleared.
+static size_t count_covered(const vector<Color8> &pixels)
+{
+    size_t count = 0;
+    for (auto c : pixels)
+        count += c[3] != 0;
+
+    return count;
+}
+
+// Draws with forward and then with deferred shading, and returns the output
+// of forward shading and the number of pixels where the two differ.
+template <ShaderProgram S>
+static std::pair<vector<Color8>, size_t>
+compare_shading_modes(Rasterizer &rasterizer, const Camera &camera,
+                      const S &shader)
+{
+    rasterizer.set_shading_mode(ShadingMode::forward);
+    rasterizer.clear();
+    rasterizer.draw(camera, shader);
+    auto forward = rasterizer.get_color_buffer().to_linear();
+
+    rasterizer.set_shading_mode(ShadingMode::deferred);
+    rasterizer.clear();
+    rasterizer.draw(camera, shader);
+    auto differences = count_differences(
+        forward, rasterizer.get_color_buffer().to_linear());
+
+    return {std::move(forward), differences};
+}
+
+// Mip levels are picked from the derivatives of the texture coordinates,
+// which both shading modes must take from the same triangle setup.
+static void test_textured_back_faces()
+{
+    // Checkerboard of 4x4 texel squares, whose mip levels fade to gray, so
+    // that sampling another level changes the color.
+    constexpr int size = 256;
+    vector<Color8> texels(size * size);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            texels[x + y * size] = (x / 4 + y / 4) % 2
+                                       ? Color8{255, 255, 255, 255}
+                                       : Color8{0, 0, 0, 255};
+
+    Texture texture{size, size, texels.data()};
+    texture.filter = Texture::Filter::trilinear;
+
+    // Floor that recedes into the distance, seen from below as back faces.
+    // Its far triangles become slivers, whose derivatives depend the most on
+    // snapping.
+    constexpr int cells = 64;
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+
+    for (int j = 0; j <= cells; j++)
+        for (int i = 0; i <= cells; i++)
+        {
+            float s = static_cast<float>(i) / cells;
+            float t = static_cast<float>(j) / cells;
+            vertices.push_back(
+                Vertex{Vec3{8.f * s - 4.f, -1.f, 1.f - 200.f * t},
+                       Vec3{0.f, 1.f, 0.f}, Vec2{2.f * s, 8.f * t}});
+        }
+
+    for (uint32_t j = 0; j < cells; j++)
+        for (uint32_t i = 0; i < cells; i++)
+        {
+            uint32_t k = i + j * (cells + 1);
+            indices.insert(indices.end(), {k, k + 1, k + cells + 2, k,
+                                           k + cells + 2, k + cells + 1});
+        }
+
+    auto model = make_model(std::move(vertices), std::move(indices));
+
+    Rasterizer rasterizer{256, 256, std::move(model)};
+    rasterizer.set_cull_mode(CullMode::none);
+    Camera camera{Vec3{0.f, -1.5f, 2.f}, Vec3{0.f, -1.f, -4.f}};
+
+    TextureShader shader;
+    shader.uniforms.texture = &texture;
+
+    auto [forward, differences] =
+        compare_shading_modes(rasterizer, camera, shader);
+
+    check(count_covered(forward) > 0, "textured floor is drawn");
+    check(differences == 0,
+          "deferred shading picks the mip levels of forward shading");
+}
+
+// Back faces that are kept are flipped during setup, which must not swap
+// the varyings of the shading pass.
+static void test_deferred_back_faces()
+{
+    // Clockwise as seen from the camera, with a distinct normal per vertex.
+    Vec2 uv{0.f};
+    auto model = make_model(
+        {Vertex{Vec3{-1.f, -1.f, 0.f}, Vec3{1.f, 0.f, 0.f}, uv},
+         Vertex{Vec3{0.f, 1.f, 0.f}, Vec3{0.f, 1.f, 0.f}, uv},
+         Vertex{Vec3{1.f, -1.f, 0.f}, Vec3{0.f, 0.f, 1.f}, uv}},
+        {0, 1, 2});
+
+    Rasterizer rasterizer{64, 64, std::move(model)};
+    rasterizer.set_cull_mode(CullMode::none);
+    Camera camera{Vec3{0.f, 0.f, 2.f}, Vec3{0.f}};
+
+    auto [forward, differences] =
+        compare_shading_modes(rasterizer, camera, NormalShader{});
+
+    check(count_covered(forward) > 0, "back face is drawn with cull none");
+    check(differences == 0,
+          "deferred shading of back faces matches forward shading");
+
+    test_textured_back_faces();
+}
+
+// Returns the fraction of the pixels covered by a square, drawn with
+// triangles that span most of the screen, at the given viewport size.
+static float square_coverage(int width, int height, float size)
+{
+    auto vertex = [](float x, float y)
+    { return Vertex{Vec3{x, y, 0.f}, Vec3{0.f, 0.f, 1.f}, Vec2{0.f}}; };
+
+    auto model = make_model({vertex(-size, -size), vertex(size, -size),
+                             vertex(size, size), vertex(-size, size)},
+                            {0, 1, 2, 0, 2, 3});
+
+    Rasterizer rasterizer{width, height, std::move(model)};
+    rasterizer.draw(Camera{Vec3{0.f, 0.f, 2.f}, Vec3{0.f}}, NormalShader{});
+
+    return static_cast<float>(
+               count_covered(rasterizer.get_color_buffer().to_linear())) /
+           static_cast<float>(width * height);
+}
+
+// Viewports larger than the guard band must not overflow the fixed-point
+// edge functions of large triangles.
+static void test_large_viewport()
+{
+    float small = square_coverage(1280, 720, 1.f);
+    float large = square_coverage(5120, 2880, 1.f);
+
+    check(small > 0.1f && small < 0.9f, "square covers part of the screen");
+    check(std::abs(large - small) < 0.01f,
+          "coverage does not depend on the viewport size");
+    check(square_coverage(5120, 2880, 100.f) == 1.f,
+          "square around the camera covers the screen");
+}
+
+// Without far clipping, frustum culling must keep meshlets beyond the far
+// plane, which the rasterizer still draws.
+static void test_beyond_far_plane()
+{
+    // Small enough for its bounds to lie past the far plane at a distance of
+    // 100 from the camera.
+    auto vertex = [](float x, float y)
+    { return Vertex{Vec3{x, y, -99.5f}, Vec3{0.f, 0.f, 1.f}, Vec2{0.f}}; };
+
+    for (bool far_clipping : {false, true})
+    {
+        auto model = make_model({vertex(-.5f, -.5f), vertex(.5f, -.5f),
+                                 vertex(.5f, .5f), vertex(-.5f, .5f)},
+                                {0, 1, 2, 0, 2, 3});
+
+        Rasterizer rasterizer{512, 512, std::move(model)};
+        rasterizer.set_far_clipping(far_clipping);
+        rasterizer.draw(Camera{Vec3{0.f, 0.f, 2.f}, Vec3{0.f}},
+                        NormalShader{});
+
+        bool drawn =
+            count_covered(rasterizer.get_color_buffer().to_linear()) > 0;
+        check(drawn != far_clipping,
+              far_clipping ? "far clipping removes meshlets past far"
+                           : "meshlets past far are kept without far clipping");
+    }
+}
+
+// Meshlets copy the vertices of triangles that lie too far apart in the mesh
+// to address with 8 bits, which must render the same as vertex ranges.
+static void test_meshlet_copies()
+{
+    constexpr uint32_t columns = 300;
+    constexpr uint32_t rows = 4;
+
+    auto draw = [&](bool row_major)
+    {
+        auto index = [&](uint32_t c, uint32_t r)
+        { return row_major ? r * columns + c : c * rows + r; };
+
+        vector<Vertex> vertices(columns * rows);
+        for (uint32_t r = 0; r < rows; r++)
+            for (uint32_t c = 0; c < columns; c++)
+                vertices[index(c, r)] = Vertex{
+                    Vec3{2.f * c / (columns - 1) - 1.f,
+                         2.f * r / (rows - 1) - 1.f, 0.f},
+                    Vec3{static_cast<float>(c % 2), 0.f, 1.f}, Vec2{0.f}};
+
+        vector<uint32_t> indices;
+        for (uint32_t r = 0; r + 1 < rows; r++)
+            for (uint32_t c = 0; c + 1 < columns; c++)
+                indices.insert(indices.end(),
+                               {index(c, r), index(c + 1, r),
+                                index(c + 1, r + 1), index(c, r),
+                                index(c + 1, r + 1), index(c, r + 1)});
+
+        auto model = make_model(std::move(vertices), std::move(indices));
+
+        Meshlets meshlets{*model.mesh};
+        check(std::any_of(meshlets.meshlets.begin(), meshlets.meshlets.end(),
+                          [](const Meshlet &m) { return m.copied; }) ==
+                  row_major,
+              "only distant vertices are copied");
+
+        Rasterizer rasterizer{128, 128, std::move(model)};
+        rasterizer.draw(Camera{Vec3{0.f, 0.f, 1.f}, Vec3{0.f}},
+                        NormalShader{});
+        return rasterizer.get_color_buffer().to_linear();
+    };
+
+    auto ranges = draw(false);
+    auto copies = draw(true);
+
+    check(count_covered(ranges) > 0, "grid is drawn");
+    check(count_differences(ranges, copies) == 0,
+          "copied meshlets match vertex ranges");
+}
+
+int main()
+{
+    test_deferred_back_faces();
+    test_large_viewport();
+    test_beyond_far_plane();
+    test_meshlet_copies();
+
+    if (failures > 0)
+    {
+        std::cerr << failures << " checks failed." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}